@@ -8,10 +8,9 @@
 *****************************************************************************/
 
 #include "arith.h"
+#include "rng.h"
 #include <assert.h>
-#include <fcntl.h>
 #include <string.h>
-#include <unistd.h>
 #include <stdlib.h>
 
 
@@ -69,21 +68,11 @@ void mp_U512_set_one(uint64_t *a)
 
 void fp_random_512(uint64_t *a)
 {
-    static int fd = -1;
-    int n, i;
-    if (fd < 0 && 0 > (fd = open("/dev/urandom", O_RDONLY)))
-        exit(1);
-    for (i = 0; i < NWORDS_64 * 8; i += n)
-        if (0 >= (n = read(fd, (char *) a + i, (NWORDS_64 * 8) - i)))
-            exit(2);
+    randombytes(a, NWORDS_64 * 8);
     a[7] &= 0x3FFFFFFFFFFFFFFF;
 }
 
 
-void fp_sqr_mont_512(const uint64_t *a, uint64_t *c){
-    fp_mul_mont_512(a, a, c);
-}
-
 void fp_cpy(const uint64_t *a, uint64_t *c)
 {
     int i;
@@ -106,7 +95,22 @@ void fp_init_one(uint64_t *a)
     a[0] = 1;
 }
 
-void fp_inv(uint64_t *a)
+#ifdef _LAZY_CHECK_
+void fp_add_lazy_512_checked(const uint64_t *a, const uint64_t *b, uint64_t *c)
+{
+    felm_t t, p2;
+
+    PROFILE_OP(PROFILE_ADD);
+    // c may alias a or b: the inputs are checked first
+    assert(mp_sub_512(a, prime511, t) != 0);
+    assert(mp_sub_512(b, prime511, t) != 0);
+    (fp_add_lazy_512)(a, b, c);
+    mp_add_512(prime511, prime511, p2);
+    assert(mp_sub_512(c, p2, t) != 0);
+}
+#endif
+
+void fp_inv_chain(uint64_t *a)
 {
     // Field inversion using addition chain
     felm_t tmp[28], t;
@@ -280,7 +284,7 @@ void fp_inv(uint64_t *a)
     fp_cpy(t, a);
 }
 
-bool fp_issquare(const uint64_t *a)
+bool fp_issquare_chain(const uint64_t *a)
 {
     // Square-root check using addition chain
     felm_t tmp[27], t;
@@ -452,6 +456,297 @@ bool fp_issquare(const uint64_t *a)
     return (memcmp(t, one_Mont, sizeof(felm_t)) == 0) ? true : false;
 }   
 
+//////////// Divstep based inversion and Legendre symbol ///////////
+// Bernstein-Yang safegcd. Integers are kept in signed radix 2^62, nine
+// limbs: limbs 0..7 in [0, 2^62), the top limb carries the sign.
+#define S62_LIMBS           9
+// Bernstein-Yang bound for 511-bit inputs is 1476 divsteps: 24 x 62 = 1488
+#define DIVSTEP_BATCHES     24
+// posdivsteps have no proven bound; for p511 they reach f = g = 1 after
+// 1512 steps on average (standard deviation 34): 36 x 62 = 2232. The
+// addition chain always runs as well and covers an input that needs more.
+#define POSDIVSTEP_BATCHES  36
+
+typedef __int128 int128_t;
+
+static const int64_t p511_s62[S62_LIMBS] = { 0x1b81b90533c6c87b, 0x09c86fd15eb2a0d4,
+                                             0x16730cc1f0b4f25c, 0x2ab1b159fcd541d4,
+                                             0x3bfcc69322c9cda7, 0x3420ebb72231096b,
+                                             0x2b0d15e3e4c4ab42, 0x23a3dd03e26fff22,
+                                             0x00000000000065b4 };
+
+// p511^-1 mod 2^62
+static const uint64_t p511_inv62 = 0x193ecfe09cd1d6b3;
+
+// (2^512)^3 mod p511, moves an inverse computed on Montgomery inputs back to Montgomery form
+static const uint64_t r3_Mont[NWORDS_64] = { 0x341ef990c8683cd4, 0x48fc07393319dbc3,
+                                             0xda2d11571f166aeb, 0x1d18084ab6f4aaa4,
+                                             0xcebf1160e1702bd4, 0x5180f718e38efb44,
+                                             0x8d6906ce0ea454d8, 0x3a2040489894ff06 };
+
+static void to_s62(const uint64_t *a, int64_t *r)
+{
+    const uint64_t M62 = UINT64_MAX >> 2;
+    int i, w, s;
+    uint64_t t;
+
+    for(i = 0; i < S62_LIMBS; i++)
+    {
+        w = (62 * i) / 64;
+        s = (62 * i) % 64;
+        t = a[w] >> s;
+        if(s > 2 && w + 1 < NWORDS_64)
+            t |= a[w + 1] << (64 - s);
+        r[i] = (int64_t)(t & M62);
+    }
+}
+
+static void from_s62(const int64_t *r, uint64_t *a)
+{
+    // r is normalized: all limbs in [0, 2^62)
+    int i, k, s;
+
+    for(i = 0; i < NWORDS_64; i++)
+    {
+        k = (64 * i) / 62;
+        s = (64 * i) % 62;
+        a[i] = ((uint64_t)r[k] >> s) | ((uint64_t)r[k + 1] << (62 - s));
+    }
+}
+
+// [f, g] <- t * [f, g] / 2^62, t = [u, v; q, r]. Exact: the low 62 bits vanish.
+static void update_fg_62(int64_t *f, int64_t *g, const int64_t *t)
+{
+    const uint64_t M62 = UINT64_MAX >> 2;
+    const int64_t u = t[0], v = t[1], q = t[2], r = t[3];
+    int128_t cf, cg;
+    int i;
+
+    cf = (int128_t)u * f[0] + (int128_t)v * g[0];
+    cg = (int128_t)q * f[0] + (int128_t)r * g[0];
+    cf >>= 62;
+    cg >>= 62;
+    for(i = 1; i < S62_LIMBS; i++)
+    {
+        cf += (int128_t)u * f[i] + (int128_t)v * g[i];
+        cg += (int128_t)q * f[i] + (int128_t)r * g[i];
+        f[i - 1] = (int64_t)((uint64_t)cf & M62);
+        g[i - 1] = (int64_t)((uint64_t)cg & M62);
+        cf >>= 62;
+        cg >>= 62;
+    }
+    f[S62_LIMBS - 1] = (int64_t)cf;
+    g[S62_LIMBS - 1] = (int64_t)cg;
+}
+
+// [d, e] <- t * [d, e] / 2^62 mod p511, keeping d, e in (-2p, p)
+static void update_de_62(int64_t *d, int64_t *e, const int64_t *t)
+{
+    const uint64_t M62 = UINT64_MAX >> 2;
+    const int64_t u = t[0], v = t[1], q = t[2], r = t[3];
+    int64_t md, me, sd, se;
+    int128_t cd, ce;
+    int i;
+
+    // [md, me] start as zero; plus [u, q] if d is negative; plus [v, r] if e is negative
+    sd = d[S62_LIMBS - 1] >> 63;
+    se = e[S62_LIMBS - 1] >> 63;
+    md = (u & sd) + (v & se);
+    me = (q & sd) + (r & se);
+
+    cd = (int128_t)u * d[0] + (int128_t)v * e[0];
+    ce = (int128_t)q * d[0] + (int128_t)r * e[0];
+    // Choose md, me so that t * [d, e] + p * [md, me] has 62 zero bottom bits
+    md -= (int64_t)((p511_inv62 * (uint64_t)cd + (uint64_t)md) & M62);
+    me -= (int64_t)((p511_inv62 * (uint64_t)ce + (uint64_t)me) & M62);
+    cd += (int128_t)p511_s62[0] * md;
+    ce += (int128_t)p511_s62[0] * me;
+    cd >>= 62;
+    ce >>= 62;
+    for(i = 1; i < S62_LIMBS; i++)
+    {
+        cd += (int128_t)u * d[i] + (int128_t)v * e[i] + (int128_t)p511_s62[i] * md;
+        ce += (int128_t)q * d[i] + (int128_t)r * e[i] + (int128_t)p511_s62[i] * me;
+        d[i - 1] = (int64_t)((uint64_t)cd & M62);
+        e[i - 1] = (int64_t)((uint64_t)ce & M62);
+        cd >>= 62;
+        ce >>= 62;
+    }
+    d[S62_LIMBS - 1] = (int64_t)cd;
+    e[S62_LIMBS - 1] = (int64_t)ce;
+}
+
+// Brings r from (-2p, p) to [0, p), negating it first if sign < 0
+static void normalize_62(int64_t *r, int64_t sign)
+{
+    const int64_t M62 = (int64_t)(UINT64_MAX >> 2);
+    int64_t cond_add, cond_negate;
+    int i;
+
+    cond_add = r[S62_LIMBS - 1] >> 63;
+    for(i = 0; i < S62_LIMBS; i++)
+        r[i] += p511_s62[i] & cond_add;
+    cond_negate = sign >> 63;
+    for(i = 0; i < S62_LIMBS; i++)
+        r[i] = (r[i] ^ cond_negate) - cond_negate;
+    for(i = 0; i < S62_LIMBS - 1; i++)
+    {
+        r[i + 1] += r[i] >> 62;
+        r[i] &= M62;
+    }
+
+    cond_add = r[S62_LIMBS - 1] >> 63;
+    for(i = 0; i < S62_LIMBS; i++)
+        r[i] += p511_s62[i] & cond_add;
+    for(i = 0; i < S62_LIMBS - 1; i++)
+    {
+        r[i + 1] += r[i] >> 62;
+        r[i] &= M62;
+    }
+}
+
+void fp_inv_safegcd(uint64_t *a)
+{
+    // Constant-time inversion: a fixed number of batches of 62 divsteps
+    int64_t d[S62_LIMBS] = {0}, e[S62_LIMBS] = {0}, f[S62_LIMBS], g[S62_LIMBS], t[4];
+    int64_t delta = 1;
+    int i;
+
+    e[0] = 1;
+    memcpy(f, p511_s62, sizeof(f));
+    to_s62(a, g);
+
+    for(i = 0; i < DIVSTEP_BATCHES; i++)
+    {
+        delta = fp_divsteps_62(delta, (uint64_t)f[0], (uint64_t)g[0], t);
+        update_de_62(d, e, t);
+        update_fg_62(f, g, t);
+    }
+
+    // f = +/-1 and d = +/-(aR)^-1, so (aR)^-1 * R^3 / R = a^-1 * R
+    normalize_62(d, f[S62_LIMBS - 1]);
+    from_s62(d, a);
+    fp_mul_mont_512(a, r3_Mont, a);
+}
+
+bool fp_issquare_safegcd(const uint64_t *a)
+{
+    // Jacobi symbol (a | p511) with posdivsteps, which keep f and g
+    // non-negative so the symbol can be tracked from their low bits.
+    // Legendre(a * R) = Legendre(a) as R = 2^512 is a square.
+    int64_t f[S62_LIMBS], g[S62_LIMBS], t[4];
+    int64_t eta = -1;
+    uint64_t jac = 0, unconverged = 0, nonzero = 0, mask, r;
+    int i;
+
+    memcpy(f, p511_s62, sizeof(f));
+    to_s62(a, g);
+    for(i = 0; i < S62_LIMBS; i++)
+        nonzero |= (uint64_t)g[i];
+
+    for(i = 0; i < POSDIVSTEP_BATCHES; i++)
+    {
+        eta = fp_posdivsteps_62(eta, (uint64_t)f[0] | ((uint64_t)f[1] << 62), 
+                                (uint64_t)g[0] | ((uint64_t)g[1] << 62), t, &jac);
+        update_fg_62(f, g, t);
+    }
+
+    // f = g = 1 is the fixed point reached once the gcd is found
+    unconverged = ((uint64_t)f[0] ^ 1) | ((uint64_t)g[0] ^ 1);
+    for(i = 1; i < S62_LIMBS; i++)
+        unconverged |= (uint64_t)f[i] | (uint64_t)g[i];
+
+    // All-ones if a nonzero input did not converge: the chain answers instead.
+    // Both results are always computed so the running time does not depend on a.
+    mask = 0 - (((unconverged | (0 - unconverged)) & (nonzero | (0 - nonzero))) >> 63);
+    r = ((uint64_t)(nonzero != 0) & ~jac & 1) & ~mask;
+    r |= (uint64_t)fp_issquare_chain(a) & mask;
+
+    return (bool)r;
+}
+
+void fp_inv(uint64_t *a)
+{
+    PROFILE_OP(PROFILE_INV);
+    PROFILE_SUSPEND();
+#ifdef _SAFEGCD_
+    fp_inv_safegcd(a);
+#else
+    fp_inv_chain(a);
+#endif
+    PROFILE_RESUME();
+}
+
+bool fp_issquare(const uint64_t *a)
+{
+    bool r;
+
+    // The chain also in SAFEGCD builds: fp_issquare_safegcd has to run it as a fallback
+    PROFILE_OP(PROFILE_ISSQUARE);
+    PROFILE_SUSPEND();
+    r = fp_issquare_chain(a);
+    PROFILE_RESUME();
+    return r;
+}
+
+void fp_inv_batch(felm_t *v, size_t n)
+{
+    // Montgomery's trick: n inversions for one fp_inv and 3(n-1) multiplications.
+    // Zero entries are mapped to zero as fp_inv does, without branching on them.
+    felm_t *prefix, acc, t;
+    uint64_t *zmask, nz;
+    size_t i;
+    int j;
+
+    if(n == 0)
+        return;
+
+    prefix = malloc(n * sizeof(felm_t));
+    zmask = malloc(n * sizeof(uint64_t));
+    if(prefix == NULL || zmask == NULL)
+    {
+        free(prefix);
+        free(zmask);
+        for(i = 0; i < n; i++)
+            fp_inv(v[i]);
+        return;
+    }
+
+    // Swap zeros for one so that they do not cancel the whole product
+    for(i = 0; i < n; i++)
+    {
+        nz = 0;
+        for(j = 0; j < NWORDS_64; j++)
+            nz |= v[i][j];
+        zmask[i] = ((nz | (0 - nz)) >> 63) - 1;
+        for(j = 0; j < NWORDS_64; j++)
+            v[i][j] ^= zmask[i] & (v[i][j] ^ one_Mont[j]);
+    }
+
+    fp_cpy(v[0], prefix[0]);
+    for(i = 1; i < n; i++)
+        fp_mul_mont_512(prefix[i - 1], v[i], prefix[i]);
+
+    fp_cpy(prefix[n - 1], acc);
+    fp_inv(acc);
+
+    // acc = (v[0]...v[i])^-1 at the start of each step
+    for(i = n - 1; i > 0; i--)
+    {
+        fp_mul_mont_512(acc, prefix[i - 1], t);
+        fp_mul_mont_512(acc, v[i], acc);
+        fp_cpy(t, v[i]);
+    }
+    fp_cpy(acc, v[0]);
+
+    for(i = 0; i < n; i++)
+        for(j = 0; j < NWORDS_64; j++)
+            v[i][j] &= ~zmask[i];
+
+    free(prefix);
+    free(zmask);
+}
+
 void to_mont(const uint64_t *in, uint64_t *out)
 {
     fp_mul_mont_512(in, r2_Mont, out);
@@ -475,6 +770,57 @@ void fp_print(uint64_t *a)
     printf("\n");    
 }
 
+#ifdef _PROFILE_OPS_
+__thread profile_ops_t profile_ops = { PHASE_OTHER, -1, 0, {{{0}}} };
+
+static const char *const phase_names[PROFILE_PHASES] = {
+    "other", "sampling", "ladder", "isogeny", "dummy isogeny", "normalization", "validation"
+};
+
+void profile_ops_reset(void)
+{
+    memset(profile_ops.count, 0, sizeof(profile_ops.count));
+    profile_ops.phase = PHASE_OTHER;
+    profile_ops.prime = -1;
+}
+
+void profile_ops_print(const char *title)
+{
+    uint64_t sum[PROFILE_PHASES][PROFILE_OPS] = {{0}}, total[PROFILE_OPS] = {0};
+    int ph, i, op;
+
+    for (ph = 0; ph < PROFILE_PHASES; ph++)
+        for (i = 0; i <= SMALL_PRIMES_COUNT; i++)
+            for (op = 0; op < PROFILE_OPS; op++)
+            {
+                sum[ph][op] += profile_ops.count[ph][i][op];
+                total[op] += profile_ops.count[ph][i][op];
+            }
+
+    printf("\n%s: field operations per phase\n", title);
+    printf("%-16s%12s%12s%12s%12s%8s%8s\n", "phase", "mul", "sqr", "add", "sub", "inv", "issq");
+    for (ph = 0; ph < PROFILE_PHASES; ph++)
+        printf("%-16s%12llu%12llu%12llu%12llu%8llu%8llu\n", phase_names[ph],
+               (unsigned long long)sum[ph][PROFILE_MUL], (unsigned long long)sum[ph][PROFILE_SQR],
+               (unsigned long long)sum[ph][PROFILE_ADD], (unsigned long long)sum[ph][PROFILE_SUB],
+               (unsigned long long)sum[ph][PROFILE_INV], (unsigned long long)sum[ph][PROFILE_ISSQUARE]);
+    printf("%-16s%12llu%12llu%12llu%12llu%8llu%8llu\n", "total",
+           (unsigned long long)total[PROFILE_MUL], (unsigned long long)total[PROFILE_SQR],
+           (unsigned long long)total[PROFILE_ADD], (unsigned long long)total[PROFILE_SUB],
+           (unsigned long long)total[PROFILE_INV], (unsigned long long)total[PROFILE_ISSQUARE]);
+
+    // Multiplications and squarings of the isogenies of each degree
+    printf("\n%s: isogeny mul + sqr per prime\n", title);
+    printf("%6s%12s%12s\n", "l", "isogeny", "dummy");
+    for (i = 0; i < SMALL_PRIMES_COUNT; i++)
+        printf("%6llu%12llu%12llu\n", (unsigned long long)smallprimes[i],
+               (unsigned long long)(profile_ops.count[PHASE_ISOGENY][i + 1][PROFILE_MUL] +
+                                    profile_ops.count[PHASE_ISOGENY][i + 1][PROFILE_SQR]),
+               (unsigned long long)(profile_ops.count[PHASE_DUMMY][i + 1][PROFILE_MUL] +
+                                    profile_ops.count[PHASE_DUMMY][i + 1][PROFILE_SQR]));
+}
+#endif
+
 //////////////// Group Arithmetic ////////////////////////
 void xDBLADD(proj_point_t R, proj_point_t S, const proj_point_t P, const proj_point_t Q, const proj_point_t PQ, const proj_point_t A24)
 {
@@ -484,7 +830,7 @@ void xDBLADD(proj_point_t R, proj_point_t S, const proj_point_t P, const proj_po
     fp_sub_512(P->X, P->Z, t1);
     fp_sqr_mont_512(t0, R->X);
     fp_sub_512(Q->X, Q->Z, t2);
-    fp_add_512(Q->X, Q->Z, S->X);
+    fp_add_lazy_512(Q->X, Q->Z, S->X);          // < 2p
     fp_mul_mont_512(t0, t2, t0);
     fp_sqr_mont_512(t1, R->Z);
     fp_mul_mont_512(t1, S->X, t1);
@@ -493,7 +839,7 @@ void xDBLADD(proj_point_t R, proj_point_t S, const proj_point_t P, const proj_po
     fp_mul_mont_512(R->X, R->Z, R->X);
     fp_mul_mont_512(t2, A24->X, S->X);
     fp_sub_512(t0, t1, S->Z);
-    fp_add_512(R->Z, S->X, R->Z);
+    fp_add_lazy_512(R->Z, S->X, R->Z);          // < 2p
     fp_add_512(t0, t1, S->X);
     fp_mul_mont_512(t2, R->Z, R->Z);
     fp_sqr_mont_512(S->Z, S->Z);
@@ -512,25 +858,25 @@ void xDBL(proj_point_t Q, const proj_point_t A, const proj_point_t P)
     fp_sqr_mont_512(t1, t1);
     fp_sub_512(t0, t1, t2);
     fp_add_512(t1, t1, t1); 
-    fp_add_512(t1, t1, t1);
-    fp_mul_mont_512(t1, A->Z, t1);
+    fp_add_lazy_512(t1, t1, t1);                // < 2p
+    fp_mul_mont_512(A->Z, t1, t1);
     fp_mul_mont_512(t0, t1, Q->X);
     fp_add_512(A->Z, A->Z, t0); 
-    fp_add_512(A->X, t0, t0);
-    fp_mul_mont_512(t0, t2, t0);
-    fp_add_512(t0, t1, t0);
-    fp_mul_mont_512(t0, t2, Q->Z);
+    fp_add_lazy_512(A->X, t0, t0);              // < 2p
+    fp_mul_mont_512(t2, t0, t0);
+    fp_add_lazy_512(t0, t1, t0);                // < 2p
+    fp_mul_mont_512(t2, t0, Q->Z);
 }
 
 void xADD(proj_point_t S, const proj_point_t P, const proj_point_t Q, const proj_point_t PQ)
 {
     felm_t t0, t1, t2, t3;
 
-    fp_add_512(P->X, P->Z, t0);
+    fp_add_lazy_512(P->X, P->Z, t0);            // < 2p
     fp_sub_512(P->X, P->Z, t1);
-    fp_add_512(Q->X, Q->Z, t2);
+    fp_add_lazy_512(Q->X, Q->Z, t2);            // < 2p
     fp_sub_512(Q->X, Q->Z, t3);
-    fp_mul_mont_512(t0, t3, t0);
+    fp_mul_mont_512(t3, t0, t0);
     fp_mul_mont_512(t1, t2, t1);
     fp_add_512(t0, t1, t2);
     fp_sub_512(t0, t1, t3);
@@ -637,6 +983,11 @@ void xMUL(proj_point_t Q, const proj_point_t A,  proj_point_t P, const UINT512_t
 }
 
 void xMUL_non_const(proj_point_t Q, const proj_point_t A,  proj_point_t P, const UINT512_t k)
+{
+    xMUL_non_const_stop(Q, A, P, k, NULL);
+}
+
+bool xMUL_non_const_stop(proj_point_t Q, const proj_point_t A, proj_point_t P, const UINT512_t k, const int *stop)
 {
     proj_point_t R, tmp, A24, Pcopy;
     fp_cpy(P->X, R->X);
@@ -658,6 +1009,8 @@ void xMUL_non_const(proj_point_t Q, const proj_point_t A,  proj_point_t P, const
 
     do
     {
+        if(stop != NULL && __atomic_load_n(stop, __ATOMIC_ACQUIRE))
+            return false;
         bit = mp_U512_bit(k, nbits);
         if(bit)
         {
@@ -673,10 +1026,42 @@ void xMUL_non_const(proj_point_t Q, const proj_point_t A,  proj_point_t P, const
             fp_cpy(tmp->X, R->X);fp_cpy(tmp->Z, R->Z);
         }
     } while (nbits--);
+    return true;
+}
+
+// Constant-time ladder over the nbits low bits of k; nbits must be public
+void xMUL_bits(proj_point_t Q, const proj_point_t A, proj_point_t P, const UINT512_t k, int nbits)
+{
+    proj_point_t R, A24, Pcopy;
+    int i, bit = 0, swap, bprev = 0;
+
+    fp_cpy(P->X, R->X);
+    fp_cpy(P->Z, R->Z);
+
+    fp_cpy(P->X, Pcopy->X);
+    fp_cpy(P->Z, Pcopy->Z);
+
+    fp_cpy(one_Mont, Q->X);
+    fp_cpy(zero, Q->Z);
 
+    fp_add_512(A->Z, A->Z, A24->X);
+    fp_add_512(A24->X, A24->X, A24->Z); // 4C
+    fp_add_512(A24->X, A->X, A24->X);   // A + 2C
+
+    for (i = nbits - 1; i >= 0; i--)
+    {
+        bit = mp_U512_bit(k, i);
+        swap = bit ^ bprev;
+        bprev = bit;
+        cswap(Q, R, (0 - (uint64_t)swap));
+        xDBLADD(Q, R, Q, R, Pcopy, A24);
+    }
+
+    cswap(Q, R, (0 - (uint64_t)bit));
 }
 
-void xISOG(proj_point_t A, proj_point_t P, const proj_point_t K, const uint64_t k)
+// Velu formulas: walks all k/2 multiples of K, pushing the npts points P
+static void velu_isog(proj_point_t A, proj_point_t *P, size_t npts, const proj_point_t K, const uint64_t k)
 {
     felm_t tmp0, tmp1;
     felm_t T[4];
@@ -684,15 +1069,20 @@ void xISOG(proj_point_t A, proj_point_t P, const proj_point_t K, const uint64_t
     fp_cpy(K->X, T[1]);
     fp_cpy(K->X, T[2]);
     fp_cpy(K->Z, T[3]);
-    proj_point_t Q;
+    proj_point_t Q[XISOG_MAX_POINTS];
+    size_t j;
 
-    fp_mul_mont_512(P->X, K->X, Q->X);
-    fp_mul_mont_512(P->Z, K->Z, tmp0);
-    fp_sub_512(Q->X, tmp0, Q->X);
+    assert(npts <= XISOG_MAX_POINTS);
+    for (j = 0; j < npts; j++)
+    {
+        fp_mul_mont_512(P[j]->X, K->X, Q[j]->X);
+        fp_mul_mont_512(P[j]->Z, K->Z, tmp0);
+        fp_sub_512(Q[j]->X, tmp0, Q[j]->X);
 
-    fp_mul_mont_512(P->X, K->Z, Q->Z);
-    fp_mul_mont_512(P->Z, K->X, tmp0);
-    fp_sub_512(Q->Z, tmp0, Q->Z);
+        fp_mul_mont_512(P[j]->X, K->Z, Q[j]->Z);
+        fp_mul_mont_512(P[j]->Z, K->X, tmp0);
+        fp_sub_512(Q[j]->Z, tmp0, Q[j]->Z);
+    }
 
     proj_point_t M[3];
     int i;
@@ -709,36 +1099,38 @@ void xISOG(proj_point_t A, proj_point_t P, const proj_point_t K, const uint64_t
 
         fp_mul_mont_512(M[i % 3]->X, T[0], tmp0);
         fp_mul_mont_512(M[i % 3]->Z, T[1], tmp1);
-        fp_add_512(tmp0, tmp1, T[0]);
+        fp_add_lazy_512(tmp0, tmp1, T[0]);      // < 2p
 
         fp_mul_mont_512(M[i % 3]->X, T[1], T[1]);
 
         fp_mul_mont_512(M[i % 3]->Z, T[2], tmp0);
         fp_mul_mont_512(M[i % 3]->X, T[3], tmp1);
-        fp_add_512(tmp0, tmp1, T[2]);
+        fp_add_lazy_512(tmp0, tmp1, T[2]);      // < 2p
 
         fp_mul_mont_512(M[i % 3]->Z, T[3], T[3]);
 
-
-        fp_mul_mont_512(P->X, M[i % 3]->X, tmp0);
-        fp_mul_mont_512(P->Z, M[i % 3]->Z, tmp1);
-        fp_sub_512(tmp0, tmp1, tmp0);
-        fp_mul_mont_512(Q->X, tmp0, Q->X);
-
-        fp_mul_mont_512(P->X, M[i % 3]->Z, tmp0);
-        fp_mul_mont_512(P->Z, M[i % 3]->X, tmp1);
-        fp_sub_512(tmp0, tmp1, tmp0);
-        fp_mul_mont_512(Q->Z, tmp0, Q->Z);
+        for (j = 0; j < npts; j++)
+        {
+            fp_mul_mont_512(P[j]->X, M[i % 3]->X, tmp0);
+            fp_mul_mont_512(P[j]->Z, M[i % 3]->Z, tmp1);
+            fp_sub_512(tmp0, tmp1, tmp0);
+            fp_mul_mont_512(Q[j]->X, tmp0, Q[j]->X);
+
+            fp_mul_mont_512(P[j]->X, M[i % 3]->Z, tmp0);
+            fp_mul_mont_512(P[j]->Z, M[i % 3]->X, tmp1);
+            fp_sub_512(tmp0, tmp1, tmp0);
+            fp_mul_mont_512(Q[j]->Z, tmp0, Q[j]->Z);
+        }
     }
 
-    fp_mul_mont_512(T[0], T[1], T[0]);
-    fp_add_512(T[0], T[0], T[0]); 
+    fp_mul_mont_512(T[1], T[0], T[0]);
+    fp_add_lazy_512(T[0], T[0], T[0]);          // < 2p
     fp_sqr_mont_512(T[1], T[1]);
-    fp_mul_mont_512(T[2], T[3], T[2]);
-    fp_add_512(T[2], T[2], T[2]); 
+    fp_mul_mont_512(T[3], T[2], T[2]);
+    fp_add_lazy_512(T[2], T[2], T[2]);          // < 2p
     fp_sqr_mont_512(T[3], T[3]);
     fp_mul_mont_512(T[1], T[2], tmp0);
-    fp_mul_mont_512(T[0], T[3], tmp1);
+    fp_mul_mont_512(T[3], T[0], tmp1);
     fp_sub_512(tmp0, tmp1, tmp0);
     fp_mul_mont_512(tmp0, A->Z, tmp0);
     fp_add_512(tmp0, tmp0, tmp1); 
@@ -748,8 +1140,280 @@ void xISOG(proj_point_t A, proj_point_t P, const proj_point_t K, const uint64_t
     fp_sub_512(tmp1, tmp0, A->X);
     fp_sqr_mont_512(T[3], T[3]);
     fp_mul_mont_512(A->Z, T[3], A->Z);
-    fp_sqr_mont_512(Q->X, Q->X);
-    fp_sqr_mont_512(Q->Z, Q->Z);
-    fp_mul_mont_512(P->X, Q->X, P->X);
-    fp_mul_mont_512(P->Z, Q->Z, P->Z);
+    for (j = 0; j < npts; j++)
+    {
+        fp_sqr_mont_512(Q[j]->X, Q[j]->X);
+        fp_sqr_mont_512(Q[j]->Z, Q[j]->Z);
+        fp_mul_mont_512(P[j]->X, Q[j]->X, P[j]->X);
+        fp_mul_mont_512(P[j]->Z, Q[j]->Z, P[j]->Z);
+    }
+}
+
+void xISOG_velu(proj_point_t A, proj_point_t P, const proj_point_t K, const uint64_t k)
+{
+    velu_isog(A, (proj_point_t *)P, 1, K, k);
+}
+
+
+////////////////////  Square-root Velu  ////////////////////
+// Bernstein, De Feo, Leroux, Smith: the odd multiples {1, 3, ..., k-2} of K
+// are split as I +/- J plus a few leftovers, with
+//     I = {2b(2i+1) : 0 <= i < b'},  J = {2j+1 : 0 <= j < b},
+// so that the products over all multiples become resultants of the
+// degree-b' polynomial with roots x(I) and degree-2b polynomials built
+// from x(J), evaluated for the four points alpha = 1, -1, x(P) and 1/x(P).
+
+// Polynomial product, r may not alias f or g; degrees df and dg
+static void poly_mul(const felm_t *f, int df, const felm_t *g, int dg, felm_t *r)
+{
+    felm_t t;
+    int i, j;
+
+    for (i = 0; i <= df + dg; i++)
+        fp_init_zero(r[i]);
+    for (i = 0; i <= df; i++)
+    {
+        for (j = 0; j <= dg; j++)
+        {
+            fp_mul_mont_512(f[i], g[j], t);
+            fp_add_512(r[i + j], t, r[i + j]);
+        }
+    }
+}
+
+// Product tree of the quadratics q[lo..hi-1], r has degree 2(hi - lo)
+static void poly_tree_prod(felm_t (*q)[3], int lo, int hi, felm_t *r)
+{
+    felm_t left[2 * SQRTVELU_MAX_B + 1], right[2 * SQRTVELU_MAX_B + 1];
+    int mid;
+
+    if (hi - lo == 1)
+    {
+        fp_cpy(q[lo][0], r[0]);
+        fp_cpy(q[lo][1], r[1]);
+        fp_cpy(q[lo][2], r[2]);
+        return;
+    }
+    mid = lo + (hi - lo) / 2;
+    poly_tree_prod(q, lo, mid, left);
+    poly_tree_prod(q, mid, hi, right);
+    poly_mul(left, 2 * (mid - lo), right, 2 * (hi - mid), r);
+}
+
+// Horner evaluation at x of f (degree d), or of its reversal
+static void poly_eval(const felm_t *f, int d, const felm_t x, bool reversed, felm_t r)
+{
+    int i;
+
+    fp_cpy(f[reversed ? 0 : d], r);
+    for (i = d - 1; i >= 0; i--)
+    {
+        fp_mul_mont_512(r, x, r);
+        fp_add_512(r, f[reversed ? d - i : i], r);
+    }
+}
+
+// a^e for a public exponent e
+static void fp_pow_small(const felm_t a, uint64_t e, felm_t r)
+{
+    felm_t t;
+    int i;
+
+    fp_cpy(a, t);
+    for (i = 63; i >= 0 && !((e >> i) & 1); i--);
+    for (i = i - 1; i >= 0; i--)
+    {
+        fp_sqr_mont_512(t, t);
+        if ((e >> i) & 1)
+            fp_mul_mont_512(t, a, t);
+    }
+    fp_cpy(t, r);
+}
+
+// Square-root Velu, pushing the npts points P
+static void sqrtvelu_isog(proj_point_t A, proj_point_t *P, size_t npts, const proj_point_t K, const uint64_t k)
+{
+    // The control flow only depends on the public degree k
+    proj_point_t M[4 * SQRTVELU_MAX_B], I[SQRTVELU_MAX_B + 2], I4;
+    felm_t Ep[2 * SQRTVELU_MAX_B + 1], Em[2 * SQRTVELU_MAX_B + 1], Ex[2 * SQRTVELU_MAX_B + 1];
+    felm_t qp[SQRTVELU_MAX_B][3], qm[SQRTVELU_MAX_B][3], qx[SQRTVELU_MAX_B][3];
+    felm_t W[SQRTVELU_MAX_B], Cxz[SQRTVELU_MAX_B];
+    felm_t xi[SQRTVELU_MAX_B + 2];
+    felm_t s, d, xz, Cs, Cd, Axz, XX, XZ, t0, t1, t2, t3;
+    felm_t Rp, Rm, Rx, Rr;
+    int b, bp, r, n, i, j;
+    size_t pt;
+
+    for (b = 1; (uint64_t)(2 * b + 2) * (2 * b + 2) <= k - 1; b++);
+    bp = (int)((k - 1) / (4 * b));
+    r = (int)(k - 1) - 4 * b * bp;
+    n = (2 * b > r) ? 2 * b : r;
+    assert(b <= SQRTVELU_MAX_B);
+
+    // Multiples [1]K ... [n]K: baby steps J (odd) and leftovers (even, up to r)
+    fp_cpy(K->X, M[1]->X);
+    fp_cpy(K->Z, M[1]->Z);
+    xDBL(M[2], A, K);
+    for (i = 3; i <= n; i++)
+        xADD(M[i], M[i - 1], K, M[i - 2]);
+
+    // Giant steps I, made affine with a single inversion
+    fp_cpy(M[2 * b]->X, I[0]->X);
+    fp_cpy(M[2 * b]->Z, I[0]->Z);
+    xDBL(I4, A, M[2 * b]);
+    if (bp > 1)
+        xADD(I[1], I4, I[0], I[0]);
+    for (i = 2; i < bp; i++)
+        xADD(I[i], I[i - 1], I4, I[i - 2]);
+    for (i = 0; i < bp; i++)
+        fp_cpy(I[i]->Z, xi[i]);
+    fp_inv_batch(xi, bp);
+    for (i = 0; i < bp; i++)
+        fp_mul_mont_512(I[i]->X, xi[i], xi[i]);
+
+    // E_J(alpha, Z) = prod_j (F0(Z, xj) alpha^2 + F1(Z, xj) alpha + F2(Z, xj)),
+    // each factor scaled by C * Zj^2 (* Z(P)^2 for alpha = x(P))
+    for (j = 0; j < b; j++)
+    {
+        fp_add_512(M[2 * j + 1]->X, M[2 * j + 1]->Z, s);
+        fp_sqr_mont_512(s, s);
+        fp_sub_512(M[2 * j + 1]->X, M[2 * j + 1]->Z, d);
+        fp_sqr_mont_512(d, d);
+        fp_mul_mont_512(M[2 * j + 1]->X, M[2 * j + 1]->Z, xz);
+        fp_mul_mont_512(A->Z, s, Cs);
+        fp_mul_mont_512(A->Z, d, Cd);
+        fp_mul_mont_512(A->Z, xz, Cxz[j]);
+        fp_mul_mont_512(A->X, xz, Axz);
+        fp_add_512(Axz, Axz, Axz);          // 2 A xz
+
+        // alpha = 1
+        fp_cpy(Cd, qp[j][0]);
+        fp_cpy(Cd, qp[j][2]);
+        fp_add_512(Cs, Axz, t0);
+        fp_add_512(t0, t0, t0);
+        fp_sub_512(zero, t0, qp[j][1]);
+
+        // alpha = -1
+        fp_cpy(Cs, qm[j][0]);
+        fp_cpy(Cs, qm[j][2]);
+        fp_add_512(Cd, Axz, t0);
+        fp_add_512(t0, t0, qm[j][1]);
+
+        fp_sub_512(Cs, Cxz[j], t0);
+        fp_sub_512(t0, Cxz[j], t0);
+        fp_add_512(t0, Axz, W[j]);          // C (xj^2 + zj^2) + 2 A xj zj
+    }
+    poly_tree_prod(qp, 0, b, Ep);
+    poly_tree_prod(qm, 0, b, Em);
+
+    // Resultants with prod_i (Z - x(I_i)), by evaluation at the giant steps
+    fp_cpy(one_Mont, Rp);
+    fp_cpy(one_Mont, Rm);
+    for (i = 0; i < bp; i++)
+    {
+        poly_eval(Ep, 2 * b, xi[i], false, t0);
+        fp_mul_mont_512(Rp, t0, Rp);
+        poly_eval(Em, 2 * b, xi[i], false, t0);
+        fp_mul_mont_512(Rm, t0, Rm);
+    }
+
+    // Leftover multiples k-2, k-4, ..., 4bb'+1, i.e. [2]K, [4]K, ..., [r]K
+    for (i = 2; i <= r; i += 2)
+    {
+        fp_sub_512(M[i]->Z, M[i]->X, t0);
+        fp_mul_mont_512(Rp, t0, Rp);
+        fp_add_512(M[i]->Z, M[i]->X, t0);
+        fp_mul_mont_512(Rm, t0, Rm);
+    }
+
+    // Points: x' = x (prod (1 - x xs) / prod (x - xs))^2
+    for (pt = 0; pt < npts; pt++)
+    {
+        fp_sqr_mont_512(P[pt]->X, XX);
+        fp_sqr_mont_512(P[pt]->Z, t0);
+        fp_add_512(XX, t0, XX);             // X^2 + Z^2
+        fp_mul_mont_512(P[pt]->X, P[pt]->Z, XZ);
+        for (j = 0; j < b; j++)
+        {
+            fp_mul_mont_512(P[pt]->X, M[2 * j + 1]->Z, t0);
+            fp_mul_mont_512(P[pt]->Z, M[2 * j + 1]->X, t1);
+            fp_sub_512(t0, t1, t2);
+            fp_sqr_mont_512(t2, t2);
+            fp_mul_mont_512(A->Z, t2, qx[j][2]);
+            fp_mul_mont_512(P[pt]->X, M[2 * j + 1]->X, t0);
+            fp_mul_mont_512(P[pt]->Z, M[2 * j + 1]->Z, t1);
+            fp_sub_512(t0, t1, t2);
+            fp_sqr_mont_512(t2, t2);
+            fp_mul_mont_512(A->Z, t2, qx[j][0]);
+            fp_mul_mont_512(W[j], XZ, t0);
+            fp_mul_mont_512(Cxz[j], XX, t1);
+            fp_add_512(t0, t1, t0);
+            fp_add_512(t0, t0, t0);
+            fp_sub_512(zero, t0, qx[j][1]);
+        }
+        poly_tree_prod(qx, 0, b, Ex);
+
+        fp_cpy(one_Mont, Rx);
+        fp_cpy(one_Mont, Rr);
+        for (i = 0; i < bp; i++)
+        {
+            poly_eval(Ex, 2 * b, xi[i], false, t0);
+            fp_mul_mont_512(Rx, t0, Rx);
+            poly_eval(Ex, 2 * b, xi[i], true, t0);
+            fp_mul_mont_512(Rr, t0, Rr);
+        }
+        for (i = 2; i <= r; i += 2)
+        {
+            fp_mul_mont_512(P[pt]->X, M[i]->Z, t0);
+            fp_mul_mont_512(P[pt]->Z, M[i]->X, t1);
+            fp_sub_512(t0, t1, t2);
+            fp_mul_mont_512(Rx, t2, Rx);
+            fp_mul_mont_512(P[pt]->Z, M[i]->Z, t0);
+            fp_mul_mont_512(P[pt]->X, M[i]->X, t1);
+            fp_sub_512(t0, t1, t2);
+            fp_mul_mont_512(Rr, t2, Rr);
+        }
+
+        fp_sqr_mont_512(Rr, Rr);
+        fp_sqr_mont_512(Rx, Rx);
+        fp_mul_mont_512(P[pt]->X, Rr, P[pt]->X);
+        fp_mul_mont_512(P[pt]->Z, Rx, P[pt]->Z);
+    }
+
+    // Curve, in twisted Edwards form: a' = a^k h(-1)^8, d' = d^k h(1)^8
+    // with a = A + 2C, d = A - 2C; then (A' : C') = (2(a' + d') : a' - d')
+    fp_add_512(A->Z, A->Z, t0);
+    fp_add_512(A->X, t0, t1);
+    fp_sub_512(A->X, t0, t2);
+    fp_pow_small(t1, k, t1);
+    fp_pow_small(t2, k, t2);
+    for (i = 0; i < 3; i++)
+    {
+        fp_sqr_mont_512(Rm, Rm);
+        fp_sqr_mont_512(Rp, Rp);
+    }
+    fp_mul_mont_512(t1, Rm, t1);
+    fp_mul_mont_512(t2, Rp, t2);
+    fp_add_512(t1, t2, t3);
+    fp_add_512(t3, t3, A->X);
+    fp_sub_512(t1, t2, A->Z);
+}
+
+void xISOG_sqrtvelu(proj_point_t A, proj_point_t P, const proj_point_t K, const uint64_t k)
+{
+    sqrtvelu_isog(A, (proj_point_t *)P, 1, K, k);
+}
+
+void xISOG_multi(proj_point_t A, proj_point_t *P, size_t npts, const proj_point_t K, const uint64_t k)
+{
+    // The degree is public: choosing the formulas by k keeps constant-time behaviour
+    if (k >= SQRTVELU_THRESHOLD)
+        sqrtvelu_isog(A, P, npts, K, k);
+    else
+        velu_isog(A, P, npts, K, k);
+}
+
+void xISOG(proj_point_t A, proj_point_t P, const proj_point_t K, const uint64_t k)
+{
+    xISOG_multi(A, (proj_point_t *)P, 1, K, k);
 }
@@ -18,11 +18,11 @@
 #define MAX_EXPONENT        5
 #define UPPER_BOUND         50
 
-uint64_t prime511[NWORDS_64];
-uint64_t one_Mont[NWORDS_64];
-const uint64_t smallprimes[SMALL_PRIMES_COUNT];
-const uint64_t four_sqrt_p[8];
-uint64_t zero[NWORDS_64];
+extern uint64_t prime511[NWORDS_64];
+extern uint64_t one_Mont[NWORDS_64];
+extern const uint64_t smallprimes[SMALL_PRIMES_COUNT];
+extern const uint64_t four_sqrt_p[8];
+extern uint64_t zero[NWORDS_64];
 
 //////////////////  Datatypes  ///////////////////////////
 // Datatype for representing 512-bit integer
@@ -69,6 +69,19 @@ void fp_add_512(const uint64_t *a, const uint64_t *b, uint64_t *c);
 
 void fp_sub_512(const uint64_t *a, const uint64_t *b, uint64_t *c);
 
+// c = a + b < 2p without the reduction, for a, b < p. LAZY=TRUE builds use it for sums that
+// only feed the second operand of fp_mul_mont_512; other builds reduce them.
+void fp_add_lazy_512(const uint64_t *a, const uint64_t *b, uint64_t *c);
+#ifndef _LAZY_REDUCTION_
+#define fp_add_lazy_512     fp_add_512
+#elif defined(_LAZY_CHECK_) && !defined(ARITH_BACKEND)
+// LAZY=TRUE DEBUG=TRUE: asserts a, b < p and c < 2p around fp_add_lazy_512
+void fp_add_lazy_512_checked(const uint64_t *a, const uint64_t *b, uint64_t *c);
+#define fp_add_lazy_512(a, b, c)    fp_add_lazy_512_checked(a, b, c)
+#endif
+
+// The product is reduced when a < p and b < 2p: since 4p > 2^512 > 2p, only the
+// second operand may be a lazy sum
 void fp_mul_mont_512(const uint64_t *a, const uint64_t *b, uint64_t *c);
 
 void fp_sqr_mont_512(const uint64_t *a, uint64_t *c);
@@ -77,6 +90,28 @@ void fp_inv(uint64_t *a);
 
 bool fp_issquare(const uint64_t *a);
 
+// Inverts the n elements of v in place with a single fp_inv (Montgomery's trick)
+void fp_inv_batch(felm_t *v, size_t n);
+
+// Fixed addition chains (default)
+void fp_inv_chain(uint64_t *a);
+
+bool fp_issquare_chain(const uint64_t *a);
+
+// Divstep based (safegcd). _SAFEGCD_ selects the inversion; the Legendre symbol
+// also runs the chain as a fallback, so fp_issquare keeps the chain
+void fp_inv_safegcd(uint64_t *a);
+
+bool fp_issquare_safegcd(const uint64_t *a);
+
+// 62 divsteps on the low words of f and g. Writes the transition matrix
+// t = [u, v; q, r] and returns the new delta.
+int64_t fp_divsteps_62(int64_t delta, uint64_t f, uint64_t g, int64_t *t);
+
+// 62 posdivsteps (f, g >= 0) with the Jacobi symbol sign tracked in bit 0 of jac.
+// Needs the low 64 bits of f and g. Returns the new eta.
+int64_t fp_posdivsteps_62(int64_t eta, uint64_t f, uint64_t g, int64_t *t, uint64_t *jac);
+
 void to_mont(const uint64_t *in, uint64_t *out);
 
 void from_mont(const uint64_t *in, uint64_t *out);
@@ -89,8 +124,124 @@ void fp_init_one(uint64_t *a);
 
 void fp_print(uint64_t *a);
 
+#if defined(_X64_) || defined(_GENERIC_)
+///////////////////  Backend Kernels  ///////////////////////
+// Portable C (unsigned __int128) Montgomery multiplication
+void fp_mul_mont_512_generic(const uint64_t *a, const uint64_t *b, uint64_t *c);
+
+// Portable C Montgomery squaring
+void fp_sqr_mont_512_generic(const uint64_t *a, uint64_t *c);
+
+#if defined(_X64_)
+// x86-64 BMI2/ADX (MULX/ADCX/ADOX) Montgomery multiplication
+void fp_mul_mont_512_adx(const uint64_t *a, const uint64_t *b, uint64_t *c);
+
+// Returns true when fp_mul_mont_512 dispatches to the BMI2/ADX kernel
+bool fp_backend_has_adx(void);
+
+// fp_backend_use_adx(false) forces the portable multiplier, true restores the kernel if
+// the CPU has it; returns fp_backend_has_adx(). Set it before starting any threads.
+bool fp_backend_use_adx(bool enable);
+#endif
+#endif
+
+#if defined(_X64_)
+///////////////////  4-lane Arithmetic  /////////////////////
+// Field and curve operations on four independent elements at once (arith_x4.c), with
+// AVX2 kernels (arith_x4_avx2.c). felm4_t is a struct of arrays:
+// limb[i][j] holds the 29-bit limb i of lane j. Elements are in Montgomery form with
+// R = 2^522 and are kept below 2p, so that sums need no extra care.
+#define _FP4_
+
+#define NLIMBS_29           18
+#define MASK_29             0x1fffffff
+
+typedef struct {
+    uint64_t limb[NLIMBS_29][4];
+} felm4;
+
+typedef felm4 felm4_t[1];
+
+typedef struct {
+    felm4_t X;
+    felm4_t Z;
+} proj_point4;
+
+typedef proj_point4 proj_point4_t[1];
+
+// p, 2^522 - 2p, 2p with limbs of at least 2^29 but the top one, and -p^-1 mod 2^29
+extern const uint64_t p29[NLIMBS_29];
+extern const uint64_t c2p29[NLIMBS_29];
+extern const uint64_t p2r29[NLIMBS_29];
+extern const uint64_t pinv29;
+
+// True when the CPU supports the kernels (AVX2 on x64); nothing below may run otherwise
+bool fp4_available(void);
+
+// True when the kernels are available and beat the scalar multiplication, i.e. on x64
+// without the BMI2/ADX multiplier
+bool fp4_preferred(void);
+
+// Moves lane j between felm4_t and the Montgomery form of the scalar code
+void fp4_set(felm4_t r, int j, const uint64_t *a);
+
+void fp4_get(const felm4_t a, int j, uint64_t *r);
+
+// Same without the change of Montgomery radix: lane j holds the 512-bit integer t as it is.
+// fp4_get_raw returns the value of a, below 2p but not reduced.
+void fp4_set_raw(felm4_t r, int j, const uint64_t *t);
+
+void fp4_get_raw(const felm4_t a, int j, uint64_t *t);
+
+void fp4_set_one(felm4_t r);
+
+void fp4_set_zero(felm4_t r);
+
+void fp4_cpy(const felm4_t a, felm4_t c);
+
+void fp4_add_512(const felm4_t a, const felm4_t b, felm4_t c);
+
+void fp4_sub_512(const felm4_t a, const felm4_t b, felm4_t c);
+
+void fp4_mul_mont_512(const felm4_t a, const felm4_t b, felm4_t c);
+
+void fp4_sqr_mont_512(const felm4_t a, felm4_t c);
+
+// Swaps lane j of P and Q when mask[j] is all-ones
+void cswap4(proj_point4_t P, proj_point4_t Q, const uint64_t mask[4]);
+
+void xDBL4(proj_point4_t Q, const proj_point4_t A, const proj_point4_t P);
+
+void xADD4(proj_point4_t S, const proj_point4_t P, const proj_point4_t Q, const proj_point4_t PQ);
+
+void xDBLADD4(proj_point4_t R, proj_point4_t S, const proj_point4_t P, const proj_point4_t Q, const proj_point4_t PQ, const proj_point4_t A24);
+
+// Constant-time ladder over the nbits low bits of k[j] in lane j; nbits must be public
+void xMUL4_bits(proj_point4_t Q, const proj_point4_t A, const proj_point4_t P, UINT512_t *k, int nbits);
+
+// Velu isogenies of the same degree k in all lanes, pushing the npts <= XISOG_MAX_POINTS points P
+void xISOG4_multi(proj_point4_t A, proj_point4_t *P, size_t npts, const proj_point4_t K, uint64_t k);
+
+void xISOG4(proj_point4_t A, proj_point4_t P, const proj_point4_t K, uint64_t k);
+#endif
+
 
 ///////////////////  Group Arithmetic  //////////////////////
+// xISOG switches from Velu to square-root Velu for degrees >= SQRTVELU_THRESHOLD.
+// Square-root Velu pays one inversion per isogeny, so the crossover (measured with
+// the xISOG benchmark of ARITH_TEST) depends on the inversion in use.
+#ifndef SQRTVELU_THRESHOLD
+#ifdef _SAFEGCD_
+#define SQRTVELU_THRESHOLD  101
+#else
+#define SQRTVELU_THRESHOLD  191
+#endif
+#endif
+// Largest baby-step count b = floor(sqrt(k - 1) / 2) supported by xISOG_sqrtvelu
+#define SQRTVELU_MAX_B      16
+// Largest number of points xISOG_multi pushes at once
+#define XISOG_MAX_POINTS    16
+
 void cswap(proj_point_t P, proj_point_t Q, const uint64_t mask);
 
 void xDBL(proj_point_t Q, const proj_point_t A, const proj_point_t P);
@@ -103,7 +254,68 @@ void xMUL(proj_point_t Q, const proj_point_t A, proj_point_t P, const UINT512_t
 
 void xMUL_non_const(proj_point_t Q, const proj_point_t A,  proj_point_t P, const UINT512_t k);
 
-void xISOG(proj_point_t A, proj_point_t P, const proj_point_t K, uint64_t k);
+// xMUL_non_const that gives up as soon as another thread sets *stop; returns false,
+// leaving Q unspecified, if it did
+bool xMUL_non_const_stop(proj_point_t Q, const proj_point_t A, proj_point_t P, const UINT512_t k, const int *stop);
 
+// Constant-time ladder over the nbits low bits of k; nbits must be public
+void xMUL_bits(proj_point_t Q, const proj_point_t A, proj_point_t P, const UINT512_t k, int nbits);
+
+void xISOG(proj_point_t A, proj_point_t P, const proj_point_t K, uint64_t k);
 
-#endif
\ No newline at end of file
+// Isogeny with kernel <K> pushing the npts <= XISOG_MAX_POINTS points P
+void xISOG_multi(proj_point_t A, proj_point_t *P, size_t npts, const proj_point_t K, uint64_t k);
+
+// Velu formulas, linear in k
+void xISOG_velu(proj_point_t A, proj_point_t P, const proj_point_t K, uint64_t k);
+
+// Square-root Velu formulas, O~(sqrt(k)), for k >= 5 and k < (2 SQRTVELU_MAX_B + 2)^2
+void xISOG_sqrtvelu(proj_point_t A, proj_point_t P, const proj_point_t K, uint64_t k);
+
+
+//////////////////  Operation counters  /////////////////////
+#ifdef _PROFILE_OPS_
+// PROFILE_OPS=TRUE build: every field operation is counted per thread, by the
+// phase and the prime l set by its caller. Not constant-time.
+enum { PROFILE_MUL, PROFILE_SQR, PROFILE_ADD, PROFILE_SUB, PROFILE_INV, PROFILE_ISSQUARE, PROFILE_OPS };
+enum { PHASE_OTHER, PHASE_SAMPLING, PHASE_LADDER, PHASE_ISOGENY, PHASE_DUMMY, PHASE_NORMALIZE,
+       PHASE_VALIDATE, PROFILE_PHASES };
+
+typedef struct profile_ops_t {
+    int phase, prime;       // prime is an index into smallprimes, or -1
+    int suspend;            // > 0 inside fp_inv and fp_issquare
+    uint64_t count[PROFILE_PHASES][SMALL_PRIMES_COUNT + 1][PROFILE_OPS];
+} profile_ops_t;
+
+extern __thread profile_ops_t profile_ops;
+
+#define PROFILE_OP(op)          ((void)(profile_ops.suspend || \
+                                        profile_ops.count[profile_ops.phase][profile_ops.prime + 1][op]++))
+#define PROFILE_PHASE(ph, i)    (profile_ops.phase = (ph), profile_ops.prime = (int)(i))
+#define PROFILE_SUSPEND()       (profile_ops.suspend++)
+#define PROFILE_RESUME()        (profile_ops.suspend--)
+
+// Clears the counters of the calling thread
+void profile_ops_reset(void);
+
+// Prints the counters of the calling thread per phase, then the isogeny counts per prime
+void profile_ops_print(const char *title);
+
+// Backends define the primitives themselves and are not counted
+#ifndef ARITH_BACKEND
+#define fp_mul_mont_512(a, b, c)    (PROFILE_OP(PROFILE_MUL), fp_mul_mont_512(a, b, c))
+#define fp_sqr_mont_512(a, c)       (PROFILE_OP(PROFILE_SQR), fp_sqr_mont_512(a, c))
+#define fp_add_512(a, b, c)         (PROFILE_OP(PROFILE_ADD), fp_add_512(a, b, c))
+#define fp_sub_512(a, b, c)         (PROFILE_OP(PROFILE_SUB), fp_sub_512(a, b, c))
+#if defined(_LAZY_REDUCTION_) && !defined(_LAZY_CHECK_)
+#define fp_add_lazy_512(a, b, c)    (PROFILE_OP(PROFILE_ADD), fp_add_lazy_512(a, b, c))
+#endif
+#endif
+#else
+#define PROFILE_OP(op)
+#define PROFILE_PHASE(ph, i)
+#define PROFILE_SUSPEND()
+#define PROFILE_RESUME()
+#endif
+
+#endif
@@ -0,0 +1,328 @@
+/****************************************************************************
+*   Portable implementation of finite field arithmetic over p511
+*                   Constant-time Implementation of CSIDH
+*
+*   Same ABI as arith_asm.S. Used on targets without the ARMv8 kernels;
+*   on x86-64 the Montgomery multiplication is dispatched at start-up to
+*   the BMI2/ADX kernel in arith_x64.S when CPUID reports both features.
+*****************************************************************************/
+
+#define ARITH_BACKEND
+#include "arith.h"
+
+#if defined(_X64_)
+#include <cpuid.h>
+#endif
+
+typedef unsigned __int128 uint128_t;
+
+static const uint64_t p511[NWORDS_64] = { 0x1b81b90533c6c87b, 0xc2721bf457aca835,
+                                          0x516730cc1f0b4f25, 0xa7aac6c567f35507,
+                                          0x5afbfcc69322c9cd, 0xb42d083aedc88c42,
+                                          0xfc8ab0d15e3e4c4a, 0x65b48e8f740f89bf };
+
+static const uint64_t minus_p511_inverse = 0x66c1301f632e294d;
+
+///////////////////  Integer Arithmetic ////////////////////
+bool mp_add_512(const uint64_t *a, const uint64_t *b, uint64_t *c)
+{
+    uint128_t t = 0;
+    int i;
+
+    for(i = 0; i < NWORDS_64; i++)
+    {
+        t += (uint128_t)a[i] + b[i];
+        c[i] = (uint64_t)t;
+        t >>= 64;
+    }
+    return (bool)t;
+}
+
+unsigned int mp_sub_512(const uint64_t *a, const uint64_t *b, uint64_t *c)
+{
+    uint128_t t;
+    uint64_t borrow = 0;
+    int i;
+
+    for(i = 0; i < NWORDS_64; i++)
+    {
+        t = (uint128_t)a[i] - b[i] - borrow;
+        c[i] = (uint64_t)t;
+        borrow = (uint64_t)(t >> 64) & 1;
+    }
+    // Same convention as the ARMv8 kernel: all-ones on borrow
+    return (unsigned int)(0 - borrow);
+}
+
+void mp_mul_u64(const uint64_t *a, const uint64_t b, uint64_t *c)
+{
+    uint128_t t = 0;
+    int i;
+
+    for(i = 0; i < NWORDS_64; i++)
+    {
+        t += (uint128_t)a[i] * b;
+        c[i] = (uint64_t)t;
+        t >>= 64;
+    }
+}
+
+///////////////////  Field Arithmetic  /////////////////////
+
+// c <- c + (p511 & mask), mask is either 0 or 0xFF...FF
+static void fp_correction(uint64_t *c, const uint64_t mask)
+{
+    uint128_t t = 0;
+    int i;
+
+    for(i = 0; i < NWORDS_64; i++)
+    {
+        t += (uint128_t)c[i] + (p511[i] & mask);
+        c[i] = (uint64_t)t;
+        t >>= 64;
+    }
+}
+
+void fp_add_512(const uint64_t *a, const uint64_t *b, uint64_t *c)
+{
+    // a, b < p511 < 2^511, hence a + b never overflows 512 bits
+    uint64_t mask;
+
+    mp_add_512(a, b, c);
+    mask = (uint64_t)(int64_t)(int)mp_sub_512(c, p511, c);
+    fp_correction(c, mask);
+}
+
+void fp_sub_512(const uint64_t *a, const uint64_t *b, uint64_t *c)
+{
+    uint64_t mask;
+
+    mask = (uint64_t)(int64_t)(int)mp_sub_512(a, b, c);
+    fp_correction(c, mask);
+}
+
+#ifdef _LAZY_REDUCTION_
+void fp_add_lazy_512(const uint64_t *a, const uint64_t *b, uint64_t *c)
+{
+    mp_add_512(a, b, c);
+}
+#endif
+
+void fp_mul_mont_512_generic(const uint64_t *a, const uint64_t *b, uint64_t *c)
+{
+    // Coarsely integrated operand scanning. The partial result stays below
+    // a + p and fits in NWORDS_64 + 1 words; for a < p and b < 2p the final
+    // t < (2p/2^512 + 1) p < 1.8p, so one subtraction reduces it.
+    uint64_t t[NWORDS_64 + 1] = {0}, m, mask;
+    uint128_t uv;
+    int i, j;
+
+    for(i = 0; i < NWORDS_64; i++)
+    {
+        uv = 0;
+        for(j = 0; j < NWORDS_64; j++)
+        {
+            uv = (uint128_t)a[j] * b[i] + t[j] + (uint64_t)(uv >> 64);
+            t[j] = (uint64_t)uv;
+        }
+        uv = (uint128_t)t[NWORDS_64] + (uint64_t)(uv >> 64);
+        t[NWORDS_64] = (uint64_t)uv;
+
+        m = t[0] * minus_p511_inverse;
+        uv = (uint128_t)m * p511[0] + t[0];
+        for(j = 1; j < NWORDS_64; j++)
+        {
+            uv = (uint128_t)m * p511[j] + t[j] + (uint64_t)(uv >> 64);
+            t[j - 1] = (uint64_t)uv;
+        }
+        uv = (uint128_t)t[NWORDS_64] + (uint64_t)(uv >> 64);
+        t[NWORDS_64 - 1] = (uint64_t)uv;
+        t[NWORDS_64] = (uint64_t)(uv >> 64);
+    }
+
+    mask = (uint64_t)(int64_t)(int)mp_sub_512(t, p511, c);
+    for(i = 0; i < NWORDS_64; i++)
+        c[i] ^= mask & (c[i] ^ t[i]);
+}
+
+void fp_sqr_mont_512_generic(const uint64_t *a, uint64_t *c)
+{
+    // Separated operand scanning: the 1024-bit square is formed from the
+    // 28 off-diagonal products (computed once and doubled) plus the 8
+    // squares a[i]^2, then reduced word by word.
+    uint64_t t[2 * NWORDS_64] = {0}, m, mask, carry;
+    uint128_t uv;
+    int i, j;
+
+    for(i = 0; i < NWORDS_64 - 1; i++)
+    {
+        uv = 0;
+        for(j = i + 1; j < NWORDS_64; j++)
+        {
+            uv = (uint128_t)a[i] * a[j] + t[i + j] + (uint64_t)(uv >> 64);
+            t[i + j] = (uint64_t)uv;
+        }
+        t[i + NWORDS_64] = (uint64_t)(uv >> 64);
+    }
+
+    carry = 0;
+    for(i = 0; i < 2 * NWORDS_64; i++)
+    {
+        m = t[i] >> 63;
+        t[i] = (t[i] << 1) | carry;
+        carry = m;
+    }
+
+    uv = 0;
+    for(i = 0; i < NWORDS_64; i++)
+    {
+        uv = (uint128_t)a[i] * a[i] + t[2 * i] + (uint64_t)(uv >> 64);
+        t[2 * i] = (uint64_t)uv;
+        uv = (uint128_t)t[2 * i + 1] + (uint64_t)(uv >> 64);
+        t[2 * i + 1] = (uint64_t)uv;
+    }
+
+    // a^2 < p^2, so a^2 + (2^512 - 1) * p < 2^1024 and carry stays one bit
+    carry = 0;
+    for(i = 0; i < NWORDS_64; i++)
+    {
+        m = t[i] * minus_p511_inverse;
+        uv = (uint128_t)m * p511[0] + t[i];
+        for(j = 1; j < NWORDS_64; j++)
+        {
+            uv = (uint128_t)m * p511[j] + t[i + j] + (uint64_t)(uv >> 64);
+            t[i + j] = (uint64_t)uv;
+        }
+        uv = (uint128_t)t[i + NWORDS_64] + carry + (uint64_t)(uv >> 64);
+        t[i + NWORDS_64] = (uint64_t)uv;
+        carry = (uint64_t)(uv >> 64);
+    }
+
+    mask = (uint64_t)(int64_t)(int)mp_sub_512(t + NWORDS_64, p511, c);
+    for(i = 0; i < NWORDS_64; i++)
+        c[i] ^= mask & (c[i] ^ t[i + NWORDS_64]);
+}
+
+int64_t fp_divsteps_62(int64_t delta, uint64_t f, uint64_t g, int64_t *t)
+{ // Branch-free Bernstein-Yang divsteps on the low 62 bits of f and g
+    uint64_t u = 1, v = 0, q = 0, r = 1, c1, c2, x;
+    int i;
+
+    for(i = 0; i < 62; i++)
+    {
+        c1 = 0 - (g & 1);                               // g odd
+        c2 = c1 & (uint64_t)((0 - delta) >> 63);        // g odd and delta > 0
+        x = (f ^ g) & c2; f ^= x; g ^= x;
+        x = (u ^ q) & c2; u ^= x; q ^= x;
+        x = (v ^ r) & c2; v ^= x; r ^= x;
+        g = (g ^ c2) - c2;
+        q = (q ^ c2) - c2;
+        r = (r ^ c2) - c2;
+        delta = (delta ^ (int64_t)c2) - (int64_t)c2;
+        g += f & c1;
+        q += u & c1;
+        r += v & c1;
+        g >>= 1;
+        u <<= 1;
+        v <<= 1;
+        delta++;
+    }
+    t[0] = (int64_t)u; t[1] = (int64_t)v;
+    t[2] = (int64_t)q; t[3] = (int64_t)r;
+    return delta;
+}
+
+int64_t fp_posdivsteps_62(int64_t eta, uint64_t f, uint64_t g, int64_t *t, uint64_t *jac)
+{ // Branch-free posdivsteps, eta = -delta. Swaps apply quadratic reciprocity,
+  // halvings apply the (2 | f) supplement.
+    uint64_t u = 1, v = 0, q = 0, r = 1, c1, c2, x, j = *jac;
+    int i;
+
+    for(i = 0; i < 62; i++)
+    {
+        c1 = 0 - (g & 1);                               // g odd
+        c2 = c1 & (uint64_t)(eta >> 63);                // g odd and eta < 0
+        x = (f ^ g) & c2; f ^= x; g ^= x;
+        x = (u ^ q) & c2; u ^= x; q ^= x;
+        x = (v ^ r) & c2; v ^= x; r ^= x;
+        eta = (eta ^ (int64_t)c2) - (int64_t)c2;
+        j ^= c2 & ((f & g) >> 1);
+        g += f & c1;
+        q += u & c1;
+        r += v & c1;
+        g >>= 1;
+        u <<= 1;
+        v <<= 1;
+        eta--;
+        j ^= (f >> 1) ^ (f >> 2);
+    }
+    t[0] = (int64_t)u; t[1] = (int64_t)v;
+    t[2] = (int64_t)q; t[3] = (int64_t)r;
+    *jac = j & 1;
+    return eta;
+}
+
+#if defined(_X64_)
+
+static void (*fp_mul_mont_512_impl)(const uint64_t *, const uint64_t *, uint64_t *) = fp_mul_mont_512_generic;
+
+static bool cpu_has_bmi2_adx(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if(!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        return false;
+    // CPUID.(EAX=07H, ECX=0H):EBX.BMI2[bit 8] and EBX.ADX[bit 19]
+    return ((ebx >> 8) & 1) && ((ebx >> 19) & 1);
+}
+
+static void fp_sqr_mont_512_adx(const uint64_t *a, uint64_t *c)
+{
+    fp_mul_mont_512_adx(a, a, c);
+}
+
+static void (*fp_sqr_mont_512_impl)(const uint64_t *, uint64_t *) = fp_sqr_mont_512_generic;
+
+bool fp_backend_use_adx(bool enable)
+{
+    enable &= cpu_has_bmi2_adx();
+    fp_mul_mont_512_impl = enable ? fp_mul_mont_512_adx : fp_mul_mont_512_generic;
+    // MULX/ADX multiplication beats the portable squaring
+    fp_sqr_mont_512_impl = enable ? fp_sqr_mont_512_adx : fp_sqr_mont_512_generic;
+    return enable;
+}
+
+__attribute__((constructor))
+static void fp_backend_init(void)
+{
+    fp_backend_use_adx(true);
+}
+
+bool fp_backend_has_adx(void)
+{
+    return fp_mul_mont_512_impl == fp_mul_mont_512_adx;
+}
+
+void fp_mul_mont_512(const uint64_t *a, const uint64_t *b, uint64_t *c)
+{
+    fp_mul_mont_512_impl(a, b, c);
+}
+
+void fp_sqr_mont_512(const uint64_t *a, uint64_t *c)
+{
+    fp_sqr_mont_512_impl(a, c);
+}
+
+#else
+
+void fp_mul_mont_512(const uint64_t *a, const uint64_t *b, uint64_t *c)
+{
+    fp_mul_mont_512_generic(a, b, c);
+}
+
+void fp_sqr_mont_512(const uint64_t *a, uint64_t *c)
+{
+    fp_sqr_mont_512_generic(a, c);
+}
+
+#endif
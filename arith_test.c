@@ -9,11 +9,23 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
 #include "arith.h"
 #include "rng.h"
 #include <string.h>
 
 #define TEST_LOOP 1000
+#define BENCH_LOOP 100000
+
+int64_t cpucycles(void)
+{ // Access system counter for benchmarking
+    struct timespec time;
+
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (int64_t)(time.tv_sec*1e9 + time.tv_nsec);
+}
 
 int test_fp_arithmetic()
 {
@@ -54,6 +66,11 @@ int test_fp_arithmetic()
         if(memcmp(c2, c3, 64) != 0)
             passed = 0;
 
+        fp_sqr_mont_512(a, c1);
+        fp_mul_mont_512(a, a, c2);
+        if(memcmp(c1, c2, 64) != 0)
+            passed = 0;
+
         fp_init_one(c);
         fp_cpy(c, d);
         fp_inv(c);
@@ -72,11 +89,673 @@ int test_fp_arithmetic()
     return passed;
 }
 
+int test_fp_safegcd()
+{ // Divstep inversion and Legendre symbol against the addition chains
+    int i, passed = 1;
+    felm_t a, c1, c2;
+
+    for(i = 0; i < TEST_LOOP + 3; i++)
+    {
+        if(i == TEST_LOOP)
+            fp_cpy(one_Mont, a);
+        else if(i == TEST_LOOP + 1)
+            fp_sub_512(zero, one_Mont, a);
+        else if(i == TEST_LOOP + 2)
+            fp_cpy(zero, a);
+        else
+        {
+            fp_random_512(a);
+            to_mont(a, a);
+        }
+
+        fp_cpy(a, c1);fp_cpy(a, c2);
+        fp_inv_chain(c1);
+        fp_inv_safegcd(c2);
+        if(memcmp(c1, c2, 64) != 0)
+            passed = 0;
+
+        if(fp_issquare_chain(a) != fp_issquare_safegcd(a))
+            passed = 0;
+
+        // a^2 is always a square, -a^2 never is as p = 3 mod 4
+        fp_sqr_mont_512(a, c1);
+        fp_sub_512(zero, c1, c2);
+        if(i != TEST_LOOP + 2 && (!fp_issquare_safegcd(c1) || fp_issquare_safegcd(c2)))
+            passed = 0;
+    }
+
+    return passed;
+}
+
+int test_rng()
+{ // ChaCha20 known answer (RFC 8439, 2.3.2) and reproducibility of a seeded DRBG
+    static const uint8_t expected[64] = {
+        0x10, 0xf1, 0xe7, 0xe4, 0xd1, 0x3b, 0x59, 0x15, 0x50, 0x0f, 0xdd, 0x1f, 0xa3, 0x20, 0x71, 0xc4,
+        0xc7, 0xd1, 0xf4, 0xc7, 0x33, 0xc0, 0x68, 0x03, 0x04, 0x22, 0xaa, 0x9a, 0xc3, 0xd4, 0x6c, 0x4e,
+        0xd2, 0x82, 0x64, 0x46, 0x07, 0x9f, 0xaa, 0x09, 0x14, 0xc2, 0xd7, 0x05, 0xd9, 0x8b, 0x02, 0xa2,
+        0xb5, 0x12, 0x9c, 0xd1, 0xde, 0x16, 0x4e, 0xb9, 0xcb, 0xd0, 0x83, 0xe8, 0xa2, 0x50, 0x3c, 0x4e };
+    uint32_t key[8];
+    uint8_t seed[32], block[64], x[3000], y[3000];
+    chacha20_drbg_t d1, d2;
+    size_t i, l;
+    int passed = 1;
+
+    for(i = 0; i < 32; i++)
+        seed[i] = (uint8_t)i;
+    for(i = 0; i < 8; i++)
+        key[i] = (uint32_t)seed[4*i] | (uint32_t)seed[4*i+1] << 8 | (uint32_t)seed[4*i+2] << 16 | (uint32_t)seed[4*i+3] << 24;
+    chacha20_block(key, 0x0900000000000001ULL, 0x4a000000ULL, block);
+    if(memcmp(block, expected, 64) != 0)
+        passed = 0;
+
+    // Same seed, same stream, however the requests are split
+    chacha20_drbg_init(&d1, seed);
+    chacha20_drbg_init(&d2, seed);
+    chacha20_drbg_randombytes(&d1, x, sizeof(x));
+    for(i = 0; i < sizeof(y); i += l)
+    {
+        l = (i % 7 + 1) * 13;
+        if(l > sizeof(y) - i)
+            l = sizeof(y) - i;
+        chacha20_drbg_randombytes(&d2, y + i, l);
+    }
+    if(memcmp(x, y, sizeof(x)) != 0)
+        passed = 0;
+
+    // The callback replaces the default source
+    chacha20_drbg_init(&d1, seed);
+    rng_set_callback(chacha20_drbg_randombytes, &d1);
+    randombytes(y, 64);
+    rng_set_callback(NULL, NULL);
+    if(memcmp(x, y, 64) != 0)
+        passed = 0;
+
+    randombytes(x, 64);
+    randombytes(y, 64);
+    if(memcmp(x, y, 64) == 0)
+        passed = 0;
+
+    // A forked child reseeds instead of replaying the parent's stream
+    {
+        int fd[2];
+        pid_t pid;
+
+        if(pipe(fd) == 0 && (pid = fork()) >= 0)
+        {
+            if(pid == 0)
+            {
+                randombytes(y, 64);
+                _exit(write(fd[1], y, 64) != 64);
+            }
+            randombytes(x, 64);
+            if(read(fd[0], y, 64) != 64 || waitpid(pid, NULL, 0) != pid || memcmp(x, y, 64) == 0)
+                passed = 0;
+            close(fd[0]);
+            close(fd[1]);
+        }
+        else
+            passed = 0;
+    }
+
+    return passed;
+}
+
+int test_fp_inv_batch()
+{ // Montgomery's trick against one inversion per element, zeros included
+    int i, j, passed = 1;
+    felm_t v[16], w[16];
+
+    for(i = 0; i < TEST_LOOP / 10; i++)
+    {
+        for(j = 0; j < 16; j++)
+        {
+            fp_random_512(v[j]);
+            to_mont(v[j], v[j]);
+        }
+        fp_cpy(zero, v[i % 16]);
+        for(j = 0; j < 16; j++)
+        {
+            fp_cpy(v[j], w[j]);
+            fp_inv(w[j]);
+        }
+        fp_inv_batch(v, 1 + i % 16);
+        for(j = 0; j < 1 + i % 16; j++)
+            if(memcmp(v[j], w[j], 64) != 0)
+                passed = 0;
+    }
+
+    return passed;
+}
+
+static void isogeny_kernel(proj_point_t K, const proj_point_t A, int i)
+{ // Random point of order smallprimes[i] on the curve A, via [(p+1)/l]
+    UINT512_t cof;
+    proj_point_t P;
+    int j;
+
+    mp_U512_set_zero(cof);
+    cof[0] = 4;
+    for(j = 0; j < SMALL_PRIMES_COUNT; j++)
+        if(j != i)
+            mp_mul_u64(cof, smallprimes[j], cof);
+    do
+    {
+        fp_random_512(P->X);
+        to_mont(P->X, P->X);
+        fp_cpy(one_Mont, P->Z);
+        xMUL(K, A, P, cof);
+    } while(memcmp(K->Z, zero, 64) == 0);
+}
+
+static void proj_affine(const felm_t X, const felm_t Z, felm_t x)
+{
+    felm_t t;
+
+    fp_cpy(Z, t);
+    fp_inv(t);
+    fp_mul_mont_512(X, t, x);
+}
+
+int test_xisog()
+{ // Square-root Velu against Velu for every degree it supports
+    int i, passed = 1;
+    proj_point_t A, A1, A2, P, P1, P2, K, Q[2];
+    felm_t a1, a2, x1, x2;
+
+    fp_init_zero(A->X);
+    fp_cpy(one_Mont, A->Z);
+    for(i = 1; i < SMALL_PRIMES_COUNT; i++)
+    {
+        isogeny_kernel(K, A, i);
+        fp_random_512(P->X);
+        to_mont(P->X, P->X);
+        fp_cpy(one_Mont, P->Z);
+
+        fp_cpy(A->X, A1->X);fp_cpy(A->Z, A1->Z);
+        fp_cpy(P->X, P1->X);fp_cpy(P->Z, P1->Z);
+        xISOG_velu(A1, P1, K, smallprimes[i]);
+        fp_cpy(A->X, A2->X);fp_cpy(A->Z, A2->Z);
+        fp_cpy(P->X, P2->X);fp_cpy(P->Z, P2->Z);
+        xISOG_sqrtvelu(A2, P2, K, smallprimes[i]);
+
+        proj_affine(A1->X, A1->Z, a1);
+        proj_affine(A2->X, A2->Z, a2);
+        proj_affine(P1->X, P1->Z, x1);
+        proj_affine(P2->X, P2->Z, x2);
+        if(memcmp(a1, a2, 64) != 0 || memcmp(x1, x2, 64) != 0)
+            passed = 0;
+
+        // Two points at once: P and [2]P
+        fp_cpy(A->X, A2->X);fp_cpy(A->Z, A2->Z);
+        fp_cpy(P->X, Q[0]->X);fp_cpy(P->Z, Q[0]->Z);
+        xDBL(Q[1], A, P);
+        fp_cpy(Q[1]->X, P2->X);fp_cpy(Q[1]->Z, P2->Z);
+        fp_cpy(A->X, A1->X);fp_cpy(A->Z, A1->Z);
+        xISOG(A1, P2, K, smallprimes[i]);
+        xISOG_multi(A2, Q, 2, K, smallprimes[i]);
+
+        proj_affine(A2->X, A2->Z, a2);
+        if(memcmp(a1, a2, 64) != 0)
+            passed = 0;
+        proj_affine(Q[0]->X, Q[0]->Z, x2);
+        if(memcmp(x1, x2, 64) != 0)
+            passed = 0;
+        proj_affine(P2->X, P2->Z, x1);
+        proj_affine(Q[1]->X, Q[1]->Z, x2);
+        if(memcmp(x1, x2, 64) != 0)
+            passed = 0;
+
+        // Continue from the codomain
+        fp_cpy(a1, A->X);
+        fp_cpy(one_Mont, A->Z);
+    }
+
+    return passed;
+}
+
+#if defined(_X64_) || defined(_GENERIC_)
+int test_fp_backends()
+{ // Cross-check the selected Montgomery multiplier against the portable kernel
+    int i, passed = 1;
+    felm_t a, b, c1, c2;
+
+    for(i = 0; i < TEST_LOOP; i++)
+    {
+        fp_random_512(a);fp_random_512(b);
+        to_mont(a, a);to_mont(b, b);
+
+        fp_mul_mont_512_generic(a, b, c1);
+        fp_mul_mont_512(a, b, c2);
+        if(memcmp(c1, c2, 64) != 0)
+            passed = 0;
+#if defined(_X64_)
+        fp_mul_mont_512_adx(a, b, c2);
+        if(memcmp(c1, c2, 64) != 0)
+            passed = 0;
+#endif
+        fp_mul_mont_512_generic(a, a, c1);
+        fp_sqr_mont_512_generic(a, c2);
+        if(memcmp(c1, c2, 64) != 0)
+            passed = 0;
+
+        // p - 1 is the worst case for the final correction
+        fp_sub_512(zero, one_Mont, a);
+        fp_mul_mont_512_generic(a, a, c1);
+        fp_mul_mont_512(a, a, c2);
+        if(memcmp(c1, c2, 64) != 0 || memcmp(c1, one_Mont, 64) != 0)
+            passed = 0;
+        fp_sqr_mont_512_generic(a, c2);
+        if(memcmp(c1, c2, 64) != 0)
+            passed = 0;
+    }
+
+    return passed;
+}
+#endif
+
+#ifdef _FP4_
+static void point4_get(const proj_point4_t P, int j, proj_point_t Q)
+{
+    fp4_get(P->X, j, Q->X);
+    fp4_get(P->Z, j, Q->Z);
+}
+
+static void point4_set(proj_point4_t P, int j, const proj_point_t Q)
+{
+    fp4_set(P->X, j, Q->X);
+    fp4_set(P->Z, j, Q->Z);
+}
+
+int test_fp4()
+{ // Every lane of the 4-lane kernels against the scalar field and curve arithmetic
+    int i, j, passed = 1;
+    felm_t a[4], b[4], c, r, one = {1};
+    felm4_t a4, b4, c4;
+    proj_point_t A, P[4], Q, R, K[4], P2[4];
+    proj_point4_t A4, P4, Q4, K4, PP4[2];
+    UINT512_t k[4];
+
+    for(i = 0; i < TEST_LOOP; i++)
+    {
+        for(j = 0; j < 4; j++)
+        {
+            fp_random_512(a[j]);fp_random_512(b[j]);
+            to_mont(a[j], a[j]);to_mont(b[j], b[j]);
+            if(i == 0)
+                mp_sub_512(prime511, one, a[j]);
+            fp4_set(a4, j, a[j]);
+            fp4_set(b4, j, b[j]);
+        }
+        fp4_add_512(a4, b4, c4);
+        for(j = 0; j < 4; j++)
+        {
+            fp_add_512(a[j], b[j], c);
+            fp4_get(c4, j, r);
+            passed &= !memcmp(c, r, 64);
+        }
+        fp4_sub_512(a4, b4, c4);
+        for(j = 0; j < 4; j++)
+        {
+            fp_sub_512(a[j], b[j], c);
+            fp4_get(c4, j, r);
+            passed &= !memcmp(c, r, 64);
+        }
+        fp4_mul_mont_512(a4, b4, c4);
+        for(j = 0; j < 4; j++)
+        {
+            fp_mul_mont_512(a[j], b[j], c);
+            fp4_get(c4, j, r);
+            passed &= !memcmp(c, r, 64);
+        }
+        fp4_sqr_mont_512(c4, c4);
+        fp4_sub_512(c4, a4, c4);
+        for(j = 0; j < 4; j++)
+        {
+            fp_mul_mont_512(a[j], b[j], c);
+            fp_sqr_mont_512(c, c);
+            fp_sub_512(c, a[j], c);
+            fp4_get(c4, j, r);
+            passed &= !memcmp(c, r, 64);
+        }
+    }
+
+    // Ladder with a different scalar and point in every lane
+    fp_random_512(A->X);
+    to_mont(A->X, A->X);
+    fp_cpy(one_Mont, A->Z);
+    for(j = 0; j < 4; j++)
+    {
+        fp_random_512(k[j]);
+        fp_random_512(P[j]->X);
+        to_mont(P[j]->X, P[j]->X);
+        fp_cpy(one_Mont, P[j]->Z);
+        point4_set(P4, j, P[j]);
+        point4_set(A4, j, A);
+    }
+    xMUL4_bits(Q4, A4, P4, k, 511);
+    for(j = 0; j < 4; j++)
+    {
+        xMUL_bits(Q, A, P[j], k[j], 511);
+        point4_get(Q4, j, R);
+        passed &= !memcmp(Q, R, sizeof(proj_point));
+    }
+
+    // Isogenies of a few degrees with a different kernel in every lane, pushing two points
+    fp_init_zero(A->X);
+    fp_cpy(one_Mont, A->Z);
+    for(i = 0; i < SMALL_PRIMES_COUNT; i += 24)
+    {
+        for(j = 0; j < 4; j++)
+        {
+            isogeny_kernel(K[j], A, i);
+            fp_random_512(P[j]->X);
+            to_mont(P[j]->X, P[j]->X);
+            fp_cpy(one_Mont, P[j]->Z);
+            xDBL(P2[j], A, P[j]);
+            point4_set(A4, j, A);
+            point4_set(K4, j, K[j]);
+            point4_set(PP4[0], j, P[j]);
+            point4_set(PP4[1], j, P2[j]);
+        }
+        xISOG4_multi(A4, PP4, 2, K4, smallprimes[i]);
+        for(j = 0; j < 4; j++)
+        {
+            fp_cpy(A->X, R->X);fp_cpy(A->Z, R->Z);
+            xISOG_velu(R, P[j], K[j], smallprimes[i]);
+            fp_cpy(A->X, R->X);fp_cpy(A->Z, R->Z);
+            xISOG_velu(R, P2[j], K[j], smallprimes[i]);
+            point4_get(A4, j, Q);
+            passed &= !memcmp(Q, R, sizeof(proj_point));
+            point4_get(PP4[0], j, Q);
+            passed &= !memcmp(Q, P[j], sizeof(proj_point));
+            point4_get(PP4[1], j, Q);
+            passed &= !memcmp(Q, P2[j], sizeof(proj_point));
+        }
+    }
+
+    return passed;
+}
+
+static void print_dotted(const char *name, long long nsec)
+{
+    size_t i;
+
+    printf("%s", name);
+    for(i = strlen(name); i < 58; i++)
+        putchar('.');
+    printf("%10lld nsec\n", nsec);
+}
+
+// Per-element times of the 4-lane kernels, next to those of the scalar code
+static void bench_fp4(const felm_t a, const felm_t b, const char *kernels)
+{
+    int i;
+    char name[64];
+    felm4_t a4, b4;
+    proj_point4_t P4, Q4, A24;
+    int64_t start, end;
+
+    for(i = 0; i < 4; i++)
+    {
+        fp4_set(a4, i, a);
+        fp4_set(b4, i, b);
+    }
+    start = cpucycles();
+    for(i = 0; i < BENCH_LOOP; i++)
+        fp4_mul_mont_512(a4, b4, a4);
+    end = cpucycles();
+    snprintf(name, sizeof(name), "fp4_mul_mont_512 (%s, per element) runs in", kernels);
+    print_dotted(name, (long long)((end - start)/(BENCH_LOOP * 4)));
+
+    fp4_cpy(a4, P4->X);fp4_cpy(b4, P4->Z);
+    fp4_cpy(b4, Q4->X);fp4_cpy(a4, Q4->Z);
+    fp4_cpy(a4, A24->X);fp4_cpy(b4, A24->Z);
+    start = cpucycles();
+    for(i = 0; i < BENCH_LOOP / 10; i++)
+        xDBLADD4(P4, Q4, P4, Q4, A24, A24);
+    end = cpucycles();
+    snprintf(name, sizeof(name), "xDBLADD4 (%s, per element) runs in", kernels);
+    print_dotted(name, (long long)((end - start)/(BENCH_LOOP / 10 * 4)));
+}
+#endif
+
+int test_fp_lazy()
+{ // A second operand below 2p must give the same reduced product as its reduction
+    int i, passed = 1;
+    felm_t a, b, c, s1, s2, c1, c2, one = {1};
+
+    for(i = 0; i < TEST_LOOP; i++)
+    {
+        fp_random_512(a);fp_random_512(b);fp_random_512(c);
+        to_mont(a, a);to_mont(b, b);to_mont(c, c);
+
+        mp_add_512(b, c, s1);
+        fp_add_512(b, c, s2);
+        fp_mul_mont_512(a, s1, c1);
+        fp_mul_mont_512(a, s2, c2);
+        if(memcmp(c1, c2, 64) != 0)
+            passed = 0;
+#ifdef _LAZY_REDUCTION_
+        fp_add_lazy_512(b, c, s2);
+        if(memcmp(s1, s2, 64) != 0)
+            passed = 0;
+#endif
+    }
+
+    // Worst case: (p - 1) * (2p - 1)
+    mp_sub_512(prime511, one, a);
+    mp_add_512(a, prime511, b);
+    fp_mul_mont_512(a, b, c1);
+    fp_mul_mont_512(a, a, c2);
+    if(memcmp(c1, c2, 64) != 0)
+        passed = 0;
+#ifdef _LAZY_REDUCTION_
+    // Largest lazy sum, 2p - 2. With DEBUG=TRUE this and every lazy sum of the curve
+    // formulas run by test_xisog assert their bounds
+    fp_add_lazy_512(a, a, s2);
+    mp_sub_512(b, one, s1);
+    if(memcmp(s1, s2, 64) != 0)
+        passed = 0;
+#endif
+#if defined(_X64_) || defined(_GENERIC_)
+    fp_mul_mont_512_generic(a, b, c1);
+    if(memcmp(c1, c2, 64) != 0)
+        passed = 0;
+#endif
+
+    return passed;
+}
+
+void fp_bench()
+{ // Field arithmetic over p511, same loop on every backend so the numbers
+  // can be compared between ARCH=ARM64, ARCH=x64 and ARCH=GENERIC builds
+    int i;
+    felm_t a, b, c, v[64];
+    int64_t start, end;
+
+    fp_random_512(a);fp_random_512(b);
+    to_mont(a, a);to_mont(b, b);
+
+    printf("\n\nBENCHMARKING FIELD ARITHMETIC P511\n");
+    printf("----------------------------------\n\n");
+#if defined(_X64_)
+    printf("Backend: x64 (%s)\n\n", fp_backend_has_adx() ? "BMI2/ADX" : "portable C");
+#elif defined(_GENERIC_)
+    printf("Backend: portable C\n\n");
+#else
+    printf("Backend: ARMv8 assembly\n\n");
+#endif
+
+    start = cpucycles();
+    for(i = 0; i < BENCH_LOOP; i++)
+        fp_random_512(c);
+    end = cpucycles();
+    printf("fp_random_512 runs in.....................................%10lld nsec\n", (long long)((end - start)/BENCH_LOOP));
+
+    start = cpucycles();
+    for(i = 0; i < BENCH_LOOP; i++)
+        fp_add_512(a, b, c);
+    end = cpucycles();
+    printf("fp_add_512 runs in........................................%10lld nsec\n", (long long)((end - start)/BENCH_LOOP));
+
+    start = cpucycles();
+    for(i = 0; i < BENCH_LOOP; i++)
+        fp_sub_512(a, b, c);
+    end = cpucycles();
+    printf("fp_sub_512 runs in........................................%10lld nsec\n", (long long)((end - start)/BENCH_LOOP));
+
+    start = cpucycles();
+    for(i = 0; i < BENCH_LOOP; i++)
+        fp_mul_mont_512(a, b, a);
+    end = cpucycles();
+    printf("fp_mul_mont_512 runs in...................................%10lld nsec\n", (long long)((end - start)/BENCH_LOOP));
+
+    // Squaring through the multiplier vs. the dedicated squaring kernel
+    start = cpucycles();
+    for(i = 0; i < BENCH_LOOP; i++)
+        fp_mul_mont_512(a, a, a);
+    end = cpucycles();
+    printf("fp_mul_mont_512(a, a) runs in.............................%10lld nsec\n", (long long)((end - start)/BENCH_LOOP));
+
+    start = cpucycles();
+    for(i = 0; i < BENCH_LOOP; i++)
+        fp_sqr_mont_512(a, a);
+    end = cpucycles();
+    printf("fp_sqr_mont_512 runs in...................................%10lld nsec\n", (long long)((end - start)/BENCH_LOOP));
+
+#if defined(_X64_) || defined(_GENERIC_)
+    start = cpucycles();
+    for(i = 0; i < BENCH_LOOP; i++)
+        fp_mul_mont_512_generic(a, b, a);
+    end = cpucycles();
+    printf("fp_mul_mont_512_generic runs in...........................%10lld nsec\n", (long long)((end - start)/BENCH_LOOP));
+
+    start = cpucycles();
+    for(i = 0; i < BENCH_LOOP; i++)
+        fp_sqr_mont_512_generic(a, a);
+    end = cpucycles();
+    printf("fp_sqr_mont_512_generic runs in...........................%10lld nsec\n", (long long)((end - start)/BENCH_LOOP));
+#endif
+#if defined(_X64_)
+    if(fp_backend_has_adx())
+    {
+        start = cpucycles();
+        for(i = 0; i < BENCH_LOOP; i++)
+            fp_mul_mont_512_adx(a, b, a);
+        end = cpucycles();
+        printf("fp_mul_mont_512_adx runs in...............................%10lld nsec\n", (long long)((end - start)/BENCH_LOOP));
+    }
+#endif
+#ifdef _FP4_
+    if(fp4_available())
+        bench_fp4(a, b, "AVX2");
+#endif
+
+    start = cpucycles();
+    for(i = 0; i < BENCH_LOOP / 1000; i++)
+        fp_inv(a);
+    end = cpucycles();
+    printf("fp_inv runs in............................................%10lld nsec\n", (long long)((end - start)/(BENCH_LOOP / 1000)));
+
+    for(i = 0; i < 64; i++)
+        fp_cpy(a, v[i]);
+    start = cpucycles();
+    for(i = 0; i < BENCH_LOOP / 1000; i++)
+        fp_inv_batch(v, 64);
+    end = cpucycles();
+    printf("fp_inv_batch runs in (per element, n = 64)................%10lld nsec\n", (long long)((end - start)/(BENCH_LOOP / 1000 * 64)));
+
+    start = cpucycles();
+    for(i = 0; i < BENCH_LOOP / 1000; i++)
+        fp_inv_chain(a);
+    end = cpucycles();
+    printf("fp_inv_chain runs in......................................%10lld nsec\n", (long long)((end - start)/(BENCH_LOOP / 1000)));
+
+    start = cpucycles();
+    for(i = 0; i < BENCH_LOOP / 1000; i++)
+        fp_inv_safegcd(a);
+    end = cpucycles();
+    printf("fp_inv_safegcd runs in....................................%10lld nsec\n", (long long)((end - start)/(BENCH_LOOP / 1000)));
+
+    // Velu vs square-root Velu around the threshold and for the largest degree
+    proj_point_t A, P, K;
+    const uint64_t degrees[3] = {101, 191, 587};
+    int j;
+    fp_cpy(a, A->X);fp_cpy(one_Mont, A->Z);
+    fp_cpy(b, K->X);fp_cpy(one_Mont, K->Z);
+    fp_cpy(b, P->X);fp_cpy(a, P->Z);
+    for(j = 0; j < 3; j++)
+    {
+        start = cpucycles();
+        for(i = 0; i < BENCH_LOOP / 1000; i++)
+            xISOG_velu(A, P, K, degrees[j]);
+        end = cpucycles();
+        printf("xISOG_velu (l = %3d) runs in..............................%10lld nsec\n", (int)degrees[j], (long long)((end - start)/(BENCH_LOOP / 1000)));
+
+        start = cpucycles();
+        for(i = 0; i < BENCH_LOOP / 1000; i++)
+            xISOG_sqrtvelu(A, P, K, degrees[j]);
+        end = cpucycles();
+        printf("xISOG_sqrtvelu (l = %3d) runs in..........................%10lld nsec\n", (int)degrees[j], (long long)((end - start)/(BENCH_LOOP / 1000)));
+    }
+
+    start = cpucycles();
+    for(i = 0; i < BENCH_LOOP / 1000; i++)
+        a[0] ^= fp_issquare_chain(a);
+    end = cpucycles();
+    printf("fp_issquare_chain runs in.................................%10lld nsec\n", (long long)((end - start)/(BENCH_LOOP / 1000)));
+
+    start = cpucycles();
+    for(i = 0; i < BENCH_LOOP / 1000; i++)
+        a[0] ^= fp_issquare_safegcd(a);
+    end = cpucycles();
+    printf("fp_issquare_safegcd runs in...............................%10lld nsec\n", (long long)((end - start)/(BENCH_LOOP / 1000)));
+}
+
 int main()
 {
     int passed;
 
     passed = test_fp_arithmetic();
+    if(!test_rng())
+    {
+        printf("\nrng check failed\n");
+        passed = 0;
+    }
+    if(!test_xisog())
+    {
+        printf("\nsquare-root Velu check failed\n");
+        passed = 0;
+    }
+    if(!test_fp_inv_batch())
+    {
+        printf("\nbatched inversion check failed\n");
+        passed = 0;
+    }
+    if(!test_fp_safegcd())
+    {
+        printf("\nsafegcd inversion/Legendre check failed\n");
+        passed = 0;
+    }
+    if(!test_fp_lazy())
+    {
+        printf("\nlazy reduction check failed\n");
+        passed = 0;
+    }
+#ifdef _FP4_
+    if(fp4_available() && !test_fp4())
+    {
+        printf("\n4-lane arithmetic check failed\n");
+        passed = 0;
+    }
+#endif
+#if defined(_X64_) || defined(_GENERIC_)
+    if(!test_fp_backends())
+    {
+        printf("\nfp backend cross-check failed\n");
+        passed = 0;
+    }
+#endif
 
     if(passed)
     {
@@ -84,5 +763,7 @@ int main()
     }else{
         printf("\nfp arithmetic tests failed\n");
     }
+
+    fp_bench();
     return 0;
 }
\ No newline at end of file
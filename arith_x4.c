@@ -0,0 +1,322 @@
+/****************************************************************************
+*   Efficient implementation of finite field arithmetic over p511 on ARMv8
+*                   Constant-time Implementation of CSIDH
+*
+*   4-lane field and curve arithmetic on four independent elements (ARCH=x64
+*   only). The field kernels are in arith_x4_avx2.c; this file holds the
+*   constants, the lane conversions and the group arithmetic, which only
+*   call the kernels.
+*****************************************************************************/
+#include <string.h>
+#include <assert.h>
+#include "arith.h"
+
+// p511 in radix 2^29
+const uint64_t p29[NLIMBS_29] = { 0x13c6c87b, 0x1c0dc829, 0x0b2a0d46, 0x0437e8af, 0x14f25c27, 0x18660f85,
+                                  0x141d459c, 0x18acfe6a, 0x0da7aac6, 0x1499164e, 0x16beff31, 0x1b911884,
+                                  0x02d083ae, 0x1f26255a, 0x0ac34578, 0x1137ff91, 0x0e8f740f, 0x00032da4 };
+
+// 2^522 - 2p: adding it sets bit 522 exactly when the value is at least 2p
+const uint64_t c2p29[NLIMBS_29] = { 0x18726f0a, 0x07e46fac, 0x09abe572, 0x17902ea1, 0x161b47b1, 0x0f33e0f4,
+                                    0x17c574c6, 0x0ea6032a, 0x04b0aa72, 0x16cdd363, 0x1282019c, 0x08ddcef6,
+                                    0x1a5ef8a2, 0x01b3b54b, 0x0a79750e, 0x1d9000dd, 0x02e117e0, 0x1ff9a4b7 };
+
+// 2p with all limbs but the top one at least 2^29, so that 2p - b needs no borrows
+const uint64_t p2r29[NLIMBS_29] = { 0x278d90f6, 0x381b9052, 0x36541a8c, 0x286fd15d, 0x29e4b84d, 0x30cc1f0a,
+                                    0x283a8b38, 0x3159fcd4, 0x3b4f558c, 0x29322c9b, 0x2d7dfe62, 0x37223108,
+                                    0x25a1075c, 0x3e4c4ab3, 0x35868af0, 0x226fff21, 0x3d1ee81e, 0x00065b47 };
+
+// 2^522 mod p, the Montgomery form of 1
+static const uint64_t one29[NLIMBS_29] = { 0x0bf7e1d5, 0x1944150e, 0x1db05986, 0x0932b2dd, 0x044e5a15, 0x049dbf94,
+                                           0x055640f7, 0x1a92f0a2, 0x0b31e516, 0x06f67486, 0x07591d44, 0x00683014,
+                                           0x0b026cc6, 0x11020023, 0x0851a93b, 0x0b4c59fc, 0x0df0af96, 0x00018b87 };
+
+// -p^-1 mod 2^29
+const uint64_t pinv29 = 0x032e294d;
+
+// Scalar Montgomery multipliers moving between R = 2^512 and R = 2^522
+static const uint64_t to_r522[NWORDS_64] = { 0x1b2882a1cbf7e1d5, 0xa15499596ef6c166, 0x903dc93b7f2844e5, 0x31e516d497851155,
+                                             0x1d647510dece90cb, 0x46b026cc6034180a, 0xcfe2146a4ee20400, 0x3170edf0af965a62 };
+static const uint64_t to_r512[NWORDS_64] = { 0, 0, 0, 0, 0, 0, 0, 0x0040000000000000 };
+
+void fp4_set_raw(felm4_t r, int j, const uint64_t *t)
+{
+    int i, k;
+
+    for (i = 0; i < NLIMBS_29; i++)
+    {
+        k = 29 * i;
+        r->limb[i][j] = (t[k >> 6] >> (k & 63)) & MASK_29;
+        if ((k & 63) > 64 - 29 && (k >> 6) + 1 < NWORDS_64)
+            r->limb[i][j] |= (t[(k >> 6) + 1] << (64 - (k & 63))) & MASK_29;
+    }
+}
+
+void fp4_get_raw(const felm4_t a, int j, uint64_t *t)
+{
+    int i, k;
+
+    memset(t, 0, sizeof(felm_t));
+    for (i = 0; i < NLIMBS_29; i++)
+    {
+        k = 29 * i;
+        t[k >> 6] |= a->limb[i][j] << (k & 63);
+        if ((k & 63) > 64 - 29 && (k >> 6) + 1 < NWORDS_64)
+            t[(k >> 6) + 1] |= a->limb[i][j] >> (64 - (k & 63));
+    }
+}
+
+void fp4_set(felm4_t r, int j, const uint64_t *a)
+{
+    felm_t t;
+
+    fp_mul_mont_512(to_r522, a, t);
+    fp4_set_raw(r, j, t);
+}
+
+void fp4_get(const felm4_t a, int j, uint64_t *r)
+{
+    // a < 2p fits in 512 bits; the scalar multiplication reduces it
+    felm_t t;
+
+    fp4_get_raw(a, j, t);
+    fp_mul_mont_512(to_r512, t, r);
+}
+
+bool fp4_preferred(void)
+{
+    // One MULX multiplication costs less than a lane of fp4_mul_mont_512
+    return fp4_available() && !fp_backend_has_adx();
+}
+
+void fp4_set_one(felm4_t r)
+{
+    int i, j;
+
+    for (i = 0; i < NLIMBS_29; i++)
+        for (j = 0; j < 4; j++)
+            r->limb[i][j] = one29[i];
+}
+
+void fp4_set_zero(felm4_t r)
+{
+    memset(r, 0, sizeof(felm4));
+}
+
+void fp4_cpy(const felm4_t a, felm4_t c)
+{
+    memmove(c, a, sizeof(felm4));
+}
+
+void cswap4(proj_point4_t P, proj_point4_t Q, const uint64_t mask[4])
+{
+    uint64_t t;
+    int i, j;
+
+    for (i = 0; i < NLIMBS_29; i++)
+        for (j = 0; j < 4; j++)
+        {
+            t = mask[j] & (P->X->limb[i][j] ^ Q->X->limb[i][j]);
+            P->X->limb[i][j] ^= t;
+            Q->X->limb[i][j] ^= t;
+            t = mask[j] & (P->Z->limb[i][j] ^ Q->Z->limb[i][j]);
+            P->Z->limb[i][j] ^= t;
+            Q->Z->limb[i][j] ^= t;
+        }
+}
+
+static void point4_cpy(const proj_point4_t P, proj_point4_t Q)
+{
+    fp4_cpy(P->X, Q->X);
+    fp4_cpy(P->Z, Q->Z);
+}
+
+//////////////// Group Arithmetic ////////////////////////
+// Same formulas as arith.c; values stay below 2p, so no sum needs a full reduction
+void xDBLADD4(proj_point4_t R, proj_point4_t S, const proj_point4_t P, const proj_point4_t Q, const proj_point4_t PQ, const proj_point4_t A24)
+{
+    felm4_t t0, t1, t2;
+
+    fp4_add_512(P->X, P->Z, t0);
+    fp4_sub_512(P->X, P->Z, t1);
+    fp4_sqr_mont_512(t0, R->X);
+    fp4_sub_512(Q->X, Q->Z, t2);
+    fp4_add_512(Q->X, Q->Z, S->X);
+    fp4_mul_mont_512(t0, t2, t0);
+    fp4_sqr_mont_512(t1, R->Z);
+    fp4_mul_mont_512(t1, S->X, t1);
+    fp4_sub_512(R->X, R->Z, t2);
+    fp4_mul_mont_512(A24->Z, R->Z, R->Z);
+    fp4_mul_mont_512(R->X, R->Z, R->X);
+    fp4_mul_mont_512(t2, A24->X, S->X);
+    fp4_sub_512(t0, t1, S->Z);
+    fp4_add_512(R->Z, S->X, R->Z);
+    fp4_add_512(t0, t1, S->X);
+    fp4_mul_mont_512(t2, R->Z, R->Z);
+    fp4_sqr_mont_512(S->Z, S->Z);
+    fp4_sqr_mont_512(S->X, S->X);
+    fp4_mul_mont_512(PQ->X, S->Z, S->Z);
+    fp4_mul_mont_512(PQ->Z, S->X, S->X);
+}
+
+void xDBL4(proj_point4_t Q, const proj_point4_t A, const proj_point4_t P)
+{
+    felm4_t t0, t1, t2;
+
+    fp4_add_512(P->X, P->Z, t0);
+    fp4_sqr_mont_512(t0, t0);
+    fp4_sub_512(P->X, P->Z, t1);
+    fp4_sqr_mont_512(t1, t1);
+    fp4_sub_512(t0, t1, t2);
+    fp4_add_512(t1, t1, t1);
+    fp4_add_512(t1, t1, t1);
+    fp4_mul_mont_512(A->Z, t1, t1);
+    fp4_mul_mont_512(t0, t1, Q->X);
+    fp4_add_512(A->Z, A->Z, t0);
+    fp4_add_512(A->X, t0, t0);
+    fp4_mul_mont_512(t2, t0, t0);
+    fp4_add_512(t0, t1, t0);
+    fp4_mul_mont_512(t2, t0, Q->Z);
+}
+
+void xADD4(proj_point4_t S, const proj_point4_t P, const proj_point4_t Q, const proj_point4_t PQ)
+{
+    felm4_t t0, t1, t2, t3;
+
+    fp4_add_512(P->X, P->Z, t0);
+    fp4_sub_512(P->X, P->Z, t1);
+    fp4_add_512(Q->X, Q->Z, t2);
+    fp4_sub_512(Q->X, Q->Z, t3);
+    fp4_mul_mont_512(t3, t0, t0);
+    fp4_mul_mont_512(t1, t2, t1);
+    fp4_add_512(t0, t1, t2);
+    fp4_sub_512(t0, t1, t3);
+    fp4_sqr_mont_512(t2, t2);
+    fp4_sqr_mont_512(t3, t3);
+    fp4_mul_mont_512(PQ->Z, t2, S->X);
+    fp4_mul_mont_512(PQ->X, t3, S->Z);
+}
+
+void xMUL4_bits(proj_point4_t Q, const proj_point4_t A, const proj_point4_t P, UINT512_t *k, int nbits)
+{
+    proj_point4_t R, A24, Pcopy;
+    uint64_t mask[4];
+    int i, j, bit[4] = {0}, bprev[4] = {0};
+
+    point4_cpy(P, R);
+    point4_cpy(P, Pcopy);
+    fp4_set_one(Q->X);
+    fp4_set_zero(Q->Z);
+
+    fp4_add_512(A->Z, A->Z, A24->X);
+    fp4_add_512(A24->X, A24->X, A24->Z);  // 4C
+    fp4_add_512(A24->X, A->X, A24->X);    // A + 2C
+
+    for (i = nbits - 1; i >= 0; i--)
+    {
+        for (j = 0; j < 4; j++)
+        {
+            bit[j] = mp_U512_bit(k[j], i);
+            mask[j] = 0 - (uint64_t)(bit[j] ^ bprev[j]);
+            bprev[j] = bit[j];
+        }
+        cswap4(Q, R, mask);
+        xDBLADD4(Q, R, Q, R, Pcopy, A24);
+    }
+
+    for (j = 0; j < 4; j++)
+        mask[j] = 0 - (uint64_t)bit[j];
+    cswap4(Q, R, mask);
+}
+
+void xISOG4_multi(proj_point4_t A, proj_point4_t *P, size_t npts, const proj_point4_t K, uint64_t k)
+{
+    // Velu formulas for every degree: square-root Velu would need a 4-lane
+    // polynomial tree, and the lanes already share the degree
+    felm4_t tmp0, tmp1;
+    felm4_t T[4];
+    proj_point4_t Q[XISOG_MAX_POINTS], M[3];
+    size_t i, j;
+
+    assert(npts <= XISOG_MAX_POINTS);
+    fp4_cpy(K->Z, T[0]);
+    fp4_cpy(K->X, T[1]);
+    fp4_cpy(K->X, T[2]);
+    fp4_cpy(K->Z, T[3]);
+
+    for (j = 0; j < npts; j++)
+    {
+        fp4_mul_mont_512(P[j]->X, K->X, Q[j]->X);
+        fp4_mul_mont_512(P[j]->Z, K->Z, tmp0);
+        fp4_sub_512(Q[j]->X, tmp0, Q[j]->X);
+
+        fp4_mul_mont_512(P[j]->X, K->Z, Q[j]->Z);
+        fp4_mul_mont_512(P[j]->Z, K->X, tmp0);
+        fp4_sub_512(Q[j]->Z, tmp0, Q[j]->Z);
+    }
+
+    for (i = 0; i < 3; i++)
+        point4_cpy(K, M[i]);
+    xDBL4(M[1], A, K);
+
+    for (i = 1; i < k / 2; ++i)
+    {
+        if (i >= 2)
+            xADD4(M[i % 3], M[(i - 1) % 3], K, M[(i - 2) % 3]);
+
+        fp4_mul_mont_512(M[i % 3]->X, T[0], tmp0);
+        fp4_mul_mont_512(M[i % 3]->Z, T[1], tmp1);
+        fp4_add_512(tmp0, tmp1, T[0]);
+
+        fp4_mul_mont_512(M[i % 3]->X, T[1], T[1]);
+
+        fp4_mul_mont_512(M[i % 3]->Z, T[2], tmp0);
+        fp4_mul_mont_512(M[i % 3]->X, T[3], tmp1);
+        fp4_add_512(tmp0, tmp1, T[2]);
+
+        fp4_mul_mont_512(M[i % 3]->Z, T[3], T[3]);
+
+        for (j = 0; j < npts; j++)
+        {
+            fp4_mul_mont_512(P[j]->X, M[i % 3]->X, tmp0);
+            fp4_mul_mont_512(P[j]->Z, M[i % 3]->Z, tmp1);
+            fp4_sub_512(tmp0, tmp1, tmp0);
+            fp4_mul_mont_512(Q[j]->X, tmp0, Q[j]->X);
+
+            fp4_mul_mont_512(P[j]->X, M[i % 3]->Z, tmp0);
+            fp4_mul_mont_512(P[j]->Z, M[i % 3]->X, tmp1);
+            fp4_sub_512(tmp0, tmp1, tmp0);
+            fp4_mul_mont_512(Q[j]->Z, tmp0, Q[j]->Z);
+        }
+    }
+
+    fp4_mul_mont_512(T[1], T[0], T[0]);
+    fp4_add_512(T[0], T[0], T[0]);
+    fp4_sqr_mont_512(T[1], T[1]);
+    fp4_mul_mont_512(T[3], T[2], T[2]);
+    fp4_add_512(T[2], T[2], T[2]);
+    fp4_sqr_mont_512(T[3], T[3]);
+    fp4_mul_mont_512(T[1], T[2], tmp0);
+    fp4_mul_mont_512(T[3], T[0], tmp1);
+    fp4_sub_512(tmp0, tmp1, tmp0);
+    fp4_mul_mont_512(tmp0, A->Z, tmp0);
+    fp4_add_512(tmp0, tmp0, tmp1);
+    fp4_add_512(tmp0, tmp1, tmp0);
+    fp4_mul_mont_512(T[1], T[3], tmp1);
+    fp4_mul_mont_512(tmp1, A->X, tmp1);
+    fp4_sub_512(tmp1, tmp0, A->X);
+    fp4_sqr_mont_512(T[3], T[3]);
+    fp4_mul_mont_512(A->Z, T[3], A->Z);
+    for (j = 0; j < npts; j++)
+    {
+        fp4_sqr_mont_512(Q[j]->X, Q[j]->X);
+        fp4_sqr_mont_512(Q[j]->Z, Q[j]->Z);
+        fp4_mul_mont_512(P[j]->X, Q[j]->X, P[j]->X);
+        fp4_mul_mont_512(P[j]->Z, Q[j]->Z, P[j]->Z);
+    }
+}
+
+void xISOG4(proj_point4_t A, proj_point4_t P, const proj_point4_t K, uint64_t k)
+{
+    xISOG4_multi(A, (proj_point4_t *)P, 1, K, k);
+}
@@ -0,0 +1,121 @@
+/****************************************************************************
+*   Efficient implementation of finite field arithmetic over p511 on x86-64
+*                   Constant-time Implementation of CSIDH
+*
+*   AVX2 kernels of the 4-lane arithmetic (ARCH=x64). Each __m256i holds
+*   one 29-bit limb of the four lanes, so the 32x32-bit VPMULUDQ products
+*   of a Montgomery multiplication accumulate in 64-bit lanes without
+*   carries. Compiled with -mavx2; callers check fp4_available() first.
+*****************************************************************************/
+#include <immintrin.h>
+#include "arith.h"
+
+typedef __m256i vec_t;
+
+#define LOAD(a, i)      _mm256_loadu_si256((const __m256i *)(a)->limb[i])
+#define STORE(a, i, v)  _mm256_storeu_si256((__m256i *)(a)->limb[i], (v))
+
+bool fp4_available(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+// c = t mod 2p for a normalized t < 4p
+static inline void fp4_reduce(const vec_t *t, felm4_t c)
+{
+    const vec_t mask = _mm256_set1_epi64x(MASK_29);
+    vec_t y[NLIMBS_29], sel;
+    int i;
+
+    y[0] = _mm256_add_epi64(t[0], _mm256_set1_epi64x((long long)c2p29[0]));
+    for (i = 1; i < NLIMBS_29; i++)
+    {
+        y[i] = _mm256_add_epi64(t[i], _mm256_set1_epi64x((long long)c2p29[i]));
+        y[i] = _mm256_add_epi64(y[i], _mm256_srli_epi64(y[i - 1], 29));
+        y[i - 1] = _mm256_and_si256(y[i - 1], mask);
+    }
+    // All-ones in the lanes where t >= 2p
+    sel = _mm256_sub_epi64(_mm256_setzero_si256(), _mm256_srli_epi64(y[NLIMBS_29 - 1], 29));
+    y[NLIMBS_29 - 1] = _mm256_and_si256(y[NLIMBS_29 - 1], mask);
+    for (i = 0; i < NLIMBS_29; i++)
+        STORE(c, i, _mm256_blendv_epi8(t[i], y[i], sel));
+}
+
+void fp4_add_512(const felm4_t a, const felm4_t b, felm4_t c)
+{
+    const vec_t mask = _mm256_set1_epi64x(MASK_29);
+    vec_t t[NLIMBS_29];
+    int i;
+
+    t[0] = _mm256_add_epi64(LOAD(a, 0), LOAD(b, 0));
+    for (i = 1; i < NLIMBS_29; i++)
+    {
+        t[i] = _mm256_add_epi64(LOAD(a, i), LOAD(b, i));
+        t[i] = _mm256_add_epi64(t[i], _mm256_srli_epi64(t[i - 1], 29));
+        t[i - 1] = _mm256_and_si256(t[i - 1], mask);
+    }
+    fp4_reduce(t, c);
+}
+
+void fp4_sub_512(const felm4_t a, const felm4_t b, felm4_t c)
+{
+    // a + 2p - b < 4p; only the top limb may wrap before the carries arrive
+    const vec_t mask = _mm256_set1_epi64x(MASK_29);
+    vec_t t[NLIMBS_29];
+    int i;
+
+    for (i = 0; i < NLIMBS_29; i++)
+        t[i] = _mm256_sub_epi64(_mm256_add_epi64(LOAD(a, i), _mm256_set1_epi64x((long long)p2r29[i])), LOAD(b, i));
+    for (i = 1; i < NLIMBS_29; i++)
+    {
+        t[i] = _mm256_add_epi64(t[i], _mm256_srli_epi64(t[i - 1], 29));
+        t[i - 1] = _mm256_and_si256(t[i - 1], mask);
+    }
+    fp4_reduce(t, c);
+}
+
+void fp4_mul_mont_512(const felm4_t a, const felm4_t b, felm4_t c)
+{
+    // Product scanning with the Montgomery reduction folded into the columns:
+    // column k collects a_i b_(k-i) and m_i p_(k-i) in one accumulator, at most
+    // 36 products below 2^58 plus the carry, which stays below 2^64. For a, b < 2p
+    // the result is below (4p^2 + 2^522 p) / 2^522 < 2p.
+    const vec_t mask = _mm256_set1_epi64x(MASK_29), pinv = _mm256_set1_epi64x(pinv29);
+    vec_t A[NLIMBS_29], B[NLIMBS_29], m[NLIMBS_29], acc = _mm256_setzero_si256();
+    int i, k;
+
+    for (i = 0; i < NLIMBS_29; i++)
+    {
+        A[i] = LOAD(a, i);
+        B[i] = LOAD(b, i);
+    }
+
+    for (k = 0; k < NLIMBS_29; k++)
+    {
+        for (i = 0; i <= k; i++)
+            acc = _mm256_add_epi64(acc, _mm256_mul_epu32(A[i], B[k - i]));
+        for (i = 0; i < k; i++)
+            acc = _mm256_add_epi64(acc, _mm256_mul_epu32(m[i], _mm256_set1_epi64x((long long)p29[k - i])));
+        m[k] = _mm256_and_si256(_mm256_mul_epu32(acc, pinv), mask);
+        acc = _mm256_add_epi64(acc, _mm256_mul_epu32(m[k], _mm256_set1_epi64x((long long)p29[0])));
+        acc = _mm256_srli_epi64(acc, 29);
+    }
+
+    for (k = NLIMBS_29; k < 2 * NLIMBS_29 - 1; k++)
+    {
+        for (i = k - NLIMBS_29 + 1; i < NLIMBS_29; i++)
+        {
+            acc = _mm256_add_epi64(acc, _mm256_mul_epu32(A[i], B[k - i]));
+            acc = _mm256_add_epi64(acc, _mm256_mul_epu32(m[i], _mm256_set1_epi64x((long long)p29[k - i])));
+        }
+        STORE(c, k - NLIMBS_29, _mm256_and_si256(acc, mask));
+        acc = _mm256_srli_epi64(acc, 29);
+    }
+    STORE(c, NLIMBS_29 - 1, acc);
+}
+
+void fp4_sqr_mont_512(const felm4_t a, felm4_t c)
+{
+    fp4_mul_mont_512(a, a, c);
+}
@@ -0,0 +1,355 @@
+/****************************************************************************
+*   Efficient implementation of finite field arithmetic over p511 on ARMv8
+*                   Constant-time Implementation of CSIDH
+*
+*   Benchmark harness: timers, sample statistics and JSON reports
+*****************************************************************************/
+#include "bench.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+static bench_timer timer = BENCH_TIMER_CLOCK;
+static int perf_fd = -1;
+static uint64_t counter_hz = 0;
+static const char *section = "";
+static bool section_pending = false;    // title not printed yet
+static bool first_record;
+
+static uint64_t clock_ns(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000 + (uint64_t)t.tv_nsec;
+}
+
+static bool perf_open(void)
+{
+#ifdef __linux__
+    struct perf_event_attr pe;
+
+    memset(&pe, 0, sizeof(pe));
+    pe.type = PERF_TYPE_HARDWARE;
+    pe.size = sizeof(pe);
+    pe.config = PERF_COUNT_HW_CPU_CYCLES;
+    pe.exclude_kernel = 1;
+    pe.exclude_hv = 1;
+    pe.inherit = 1;         // threads joined before the read are counted too
+
+    perf_fd = (int)syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+    return perf_fd >= 0;
+#else
+    return false;
+#endif
+}
+
+static bool counter_open(void)
+{
+#if defined(__aarch64__)
+    __asm__ volatile("mrs %0, cntfrq_el0" : "=r"(counter_hz));
+    return true;
+#elif defined(__x86_64__)
+    // The TSC frequency is not architecturally exposed
+    counter_hz = 0;
+    return true;
+#else
+    return false;
+#endif
+}
+
+bench_timer bench_timer_init(bench_timer t)
+{
+    if (perf_fd >= 0)
+    {
+        close(perf_fd);
+        perf_fd = -1;
+    }
+
+    if ((t == BENCH_TIMER_AUTO || t == BENCH_TIMER_PERF) && perf_open())
+        timer = BENCH_TIMER_PERF;
+    else if (t != BENCH_TIMER_CLOCK && counter_open())
+        timer = BENCH_TIMER_COUNTER;
+    else
+        timer = BENCH_TIMER_CLOCK;
+    return timer;
+}
+
+uint64_t bench_now(void)
+{
+    uint64_t v = 0;
+
+    switch (timer)
+    {
+    case BENCH_TIMER_PERF:
+        if (read(perf_fd, &v, sizeof(v)) != sizeof(v))
+            v = 0;
+        return v;
+    case BENCH_TIMER_COUNTER:
+#if defined(__aarch64__)
+        __asm__ volatile("isb; mrs %0, cntvct_el0" : "=r"(v) :: "memory");
+#elif defined(__x86_64__)
+        v = __builtin_ia32_rdtsc();
+#endif
+        return v;
+    default:
+        return clock_ns();
+    }
+}
+
+const char *bench_unit(void)
+{
+    switch (timer)
+    {
+    case BENCH_TIMER_PERF:
+        return "cycles";
+    case BENCH_TIMER_COUNTER:
+        return "ticks";
+    default:
+        return "nsec";
+    }
+}
+
+uint64_t bench_frequency(void)
+{
+    switch (timer)
+    {
+    case BENCH_TIMER_COUNTER:
+        return counter_hz;
+    case BENCH_TIMER_CLOCK:
+        return 1000000000;
+    default:
+        return 0;
+    }
+}
+
+static const char *timer_name(void)
+{
+    switch (timer)
+    {
+    case BENCH_TIMER_PERF:
+        return "perf_event cycles";
+#if defined(__aarch64__)
+    case BENCH_TIMER_COUNTER:
+        return "cntvct_el0";
+#else
+    case BENCH_TIMER_COUNTER:
+        return "rdtsc";
+#endif
+    default:
+        return "CLOCK_MONOTONIC";
+    }
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+// Linear interpolation between the closest ranks
+static double percentile(const double *sorted, size_t n, double q)
+{
+    double pos = q * (double)(n - 1);
+    size_t i = (size_t)pos;
+
+    if (i + 1 >= n)
+        return sorted[n - 1];
+    return sorted[i] + (pos - (double)i) * (sorted[i + 1] - sorted[i]);
+}
+
+void bench_compute_stats(double *samples, size_t n, bench_stats *st)
+{
+    double sum = 0;
+    size_t i, b;
+
+    memset(st->hist, 0, sizeof(st->hist));
+    st->n = n;
+    if (n == 0)
+        return;
+
+    qsort(samples, n, sizeof(double), cmp_double);
+    for (i = 0; i < n; i++)
+        sum += samples[i];
+
+    st->min = samples[0];
+    st->max = samples[n - 1];
+    st->mean = sum / (double)n;
+    st->q1 = percentile(samples, n, 0.25);
+    st->median = percentile(samples, n, 0.50);
+    st->q3 = percentile(samples, n, 0.75);
+    st->p90 = percentile(samples, n, 0.90);
+    st->p99 = percentile(samples, n, 0.99);
+
+    // Bins span [min, p99]: the rare samples above p99 go to the last bin so
+    // that a single outlier does not flatten the histogram
+    st->hist_lo = st->min;
+    st->hist_width = (st->p99 - st->min) / BENCH_HIST_BINS;
+    for (i = 0; i < n; i++)
+    {
+        b = (st->hist_width > 0) ? (size_t)((samples[i] - st->hist_lo) / st->hist_width) : 0;
+        st->hist[b < BENCH_HIST_BINS ? b : BENCH_HIST_BINS - 1]++;
+    }
+}
+
+static void json_string(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', f);
+        fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+void bench_begin(bench_config *cfg, const char *title)
+{
+    printf("\n\n%s\n", title);
+    printf("Timer: %s, results in %s per call", timer_name(), bench_unit());
+    if (bench_frequency() && timer == BENCH_TIMER_COUNTER)
+        printf(" (%llu Hz)", (unsigned long long)bench_frequency());
+    printf("\nColumns: median, quartiles, 99th percentile, samples x calls per sample\n");
+
+    if (cfg->json == NULL)
+        return;
+    fprintf(cfg->json, "{\n  \"title\": ");
+    json_string(cfg->json, title);
+    fprintf(cfg->json, ",\n  \"build\": ");
+    json_string(cfg->json, cfg->build ? cfg->build : "");
+    fprintf(cfg->json, ",\n  \"timer\": ");
+    json_string(cfg->json, timer_name());
+    fprintf(cfg->json, ",\n  \"unit\": ");
+    json_string(cfg->json, bench_unit());
+    fprintf(cfg->json, ",\n  \"frequency_hz\": %llu,\n  \"results\": [", (unsigned long long)bench_frequency());
+    first_record = true;
+}
+
+void bench_section(bench_config *cfg, const char *title)
+{
+    // Printed with its first result, so that filtered-out sections stay silent
+    section = title;
+    section_pending = true;
+    (void)cfg;
+}
+
+static void print_result(const bench_config *cfg, const char *name, const bench_stats *st)
+{
+    size_t i, len = strlen(name);
+    uint32_t peak = 0;
+    int b, j, bar;
+
+    if (section_pending)
+    {
+        printf("\n%s\n", section);
+        for (i = strlen(section); i > 0; i--)
+            putchar('-');
+        printf("\n");
+        section_pending = false;
+    }
+
+    printf("%s", name);
+    for (i = len; i < 58; i++)
+        putchar('.');
+    printf("%12.1f  [%.1f, %.1f]  p99 %.1f  %zux%llu\n", st->median, st->q1, st->q3, st->p99,
+           st->n, (unsigned long long)st->inner);
+
+    if (!cfg->hist)
+        return;
+    for (b = 0; b < BENCH_HIST_BINS; b++)
+        if (st->hist[b] > peak)
+            peak = st->hist[b];
+    for (b = 0; b < BENCH_HIST_BINS; b++)
+    {
+        bar = peak ? (int)(40 * st->hist[b] / peak) : 0;
+        printf("    %12.1f |", st->hist_lo + b * st->hist_width);
+        for (j = 0; j < bar; j++)
+            putchar('#');
+        printf(" %u\n", st->hist[b]);
+    }
+}
+
+static void json_result(bench_config *cfg, const char *name, const bench_stats *st)
+{
+    FILE *f = cfg->json;
+    int b;
+
+    if (f == NULL)
+        return;
+    fprintf(f, "%s\n    {\"section\": ", first_record ? "" : ",");
+    json_string(f, section);
+    fprintf(f, ", \"name\": ");
+    json_string(f, name);
+    fprintf(f, ", \"samples\": %zu, \"inner\": %llu,\n", st->n, (unsigned long long)st->inner);
+    fprintf(f, "     \"min\": %.3f, \"q1\": %.3f, \"median\": %.3f, \"q3\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f, \"mean\": %.3f,\n",
+            st->min, st->q1, st->median, st->q3, st->p90, st->p99, st->max, st->mean);
+    fprintf(f, "     \"histogram\": {\"lo\": %.3f, \"width\": %.3f, \"counts\": [", st->hist_lo, st->hist_width);
+    for (b = 0; b < BENCH_HIST_BINS; b++)
+        fprintf(f, "%s%u", b ? ", " : "", st->hist[b]);
+    fprintf(f, "]}}");
+    first_record = false;
+}
+
+bool bench_run(bench_config *cfg, const char *name, bench_fn fn, void *ctx)
+{
+    uint64_t t0, t, calls = 0, inner, k;
+    double per_call, *samples;
+    size_t n, i;
+    bench_stats st;
+
+    if (cfg->filter != NULL && strstr(name, cfg->filter) == NULL)
+        return false;
+
+    // Warm-up, which also estimates the time per call; at least one call
+    t0 = clock_ns();
+    do {
+        fn(ctx);
+        calls++;
+    } while ((double)(clock_ns() - t0) < cfg->warmup_ms * 1e6);
+    per_call = (double)(clock_ns() - t0) / (double)calls;
+    if (per_call < 1)
+        per_call = 1;
+
+    inner = (uint64_t)ceil(cfg->sample_ms * 1e6 / per_call);
+    if (inner < 1)
+        inner = 1;
+    n = (size_t)(cfg->budget_ms * 1e6 / (per_call * (double)inner));
+    if (n < cfg->min_samples)
+        n = cfg->min_samples;
+    if (n > cfg->max_samples)
+        n = cfg->max_samples;
+
+    if ((samples = malloc(n * sizeof(double))) == NULL)
+        return false;
+    for (i = 0; i < n; i++)
+    {
+        t = bench_now();
+        for (k = 0; k < inner; k++)
+            fn(ctx);
+        samples[i] = (double)(bench_now() - t) / (double)inner;
+    }
+
+    bench_compute_stats(samples, n, &st);
+    st.inner = inner;
+    free(samples);
+
+    print_result(cfg, name, &st);
+    json_result(cfg, name, &st);
+    return true;
+}
+
+void bench_end(bench_config *cfg)
+{
+    if (cfg->json == NULL)
+        return;
+    fprintf(cfg->json, "\n  ]\n}\n");
+}
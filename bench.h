@@ -0,0 +1,77 @@
+/****************************************************************************
+*   Efficient implementation of finite field arithmetic over p511 on ARMv8
+*                   Constant-time Implementation of CSIDH
+*
+*   Benchmark harness: timers, sample statistics and JSON reports
+*****************************************************************************/
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#define BENCH_HIST_BINS     16
+
+typedef enum bench_timer {
+    BENCH_TIMER_AUTO,       // perf, then counter, then clock
+    BENCH_TIMER_PERF,       // CPU cycles from perf_event_open (Linux)
+    BENCH_TIMER_COUNTER,    // cntvct_el0 on ARMv8, the time-stamp counter on x86-64
+    BENCH_TIMER_CLOCK,      // CLOCK_MONOTONIC nanoseconds
+} bench_timer;
+
+typedef struct bench_stats {
+    size_t n;               // number of samples
+    uint64_t inner;         // calls timed together in each sample
+    double min, q1, median, q3, p90, p99, max, mean;
+    double hist_lo, hist_width;
+    uint32_t hist[BENCH_HIST_BINS];
+} bench_stats;
+
+typedef struct bench_config {
+    bench_timer timer;
+    double warmup_ms;       // untimed calls before sampling
+    double budget_ms;       // sampling time per benchmark
+    size_t min_samples, max_samples;
+    double sample_ms;       // minimum duration of one sample (sets inner)
+    const char *filter;     // run only benchmarks whose name contains it, or NULL
+    bool hist;              // print histograms
+    FILE *json;             // JSON report, or NULL
+    const char *build;      // build description for the report
+} bench_config;
+
+typedef void (*bench_fn)(void *ctx);
+
+/*
+Selects the timer; falls back along perf -> counter -> clock when the requested one is not
+available. Returns the selected timer.
+*/
+bench_timer bench_timer_init(bench_timer timer);
+
+// Current value of the selected timer
+uint64_t bench_now(void);
+
+// Unit of bench_now: "cycles", "ticks" or "nsec"
+const char *bench_unit(void);
+
+// Counter frequency in Hz when known (ARMv8 generic timer, clock), 0 otherwise
+uint64_t bench_frequency(void);
+
+// Sorts the n samples in place and fills the statistics and the histogram
+void bench_compute_stats(double *samples, size_t n, bench_stats *st);
+
+void bench_begin(bench_config *cfg, const char *title);
+
+// Starts a group of results; the title is printed with the first result that is not filtered out
+void bench_section(bench_config *cfg, const char *title);
+
+/*
+Runs fn(ctx) through warm-up and sampling as configured. Each sample times `inner` back-to-back
+calls, with inner chosen so that a sample lasts at least sample_ms, and records the time per
+call. Prints one line and appends one JSON record. Returns false if the benchmark was filtered out.
+*/
+bool bench_run(bench_config *cfg, const char *name, bench_fn fn, void *ctx);
+
+void bench_end(bench_config *cfg);
+
+#endif
@@ -7,87 +7,534 @@
 *                       All rights reserved   
 *****************************************************************************/
 #include <string.h>
+#include <stdlib.h>
 #include <assert.h>
+#include <pthread.h>
+#include <sched.h>
 #include "csidh_api.h"
 #include "rng.h"
 
+// In variable time the rounds of a finished sign are skipped anyway, so a second
+// point only adds pushing work
+#if defined(_DUALPOINT_) && !defined(_CONSTANT_)
+#error "DUALPOINT requires CONSTANT"
+#endif
+
+// Differential addition chains proving [l]Q = O for each small prime l. Bits are
+// read from below the leading one: starting from (a, b) = (1, 2), a one bit maps
+// (a, b) to (a, a + b) and a zero bit to (b, a + b), so that every step is one
+// xADD with the known difference b - a. 685 xADDs in total instead of 622
+// ladder steps, each of which costs two xADDs.
+static const uint16_t order_chains[SMALL_PRIMES_COUNT] = {
+    0x0003, 0x0005, 0x000b, 0x0013, 0x0011, 0x002b, 0x0029, 0x0047,
+    0x0043, 0x0051, 0x0087, 0x0093, 0x00a3, 0x0083, 0x0157, 0x011b,
+    0x01a3, 0x0113, 0x010b, 0x0129, 0x0109, 0x0307, 0x0101, 0x0207,
+    0x024b, 0x0219, 0x02c1, 0x0243, 0x042f, 0x04a7, 0x0281, 0x0427,
+    0x0487, 0x0417, 0x0569, 0x0407, 0x0453, 0x0543, 0x0529, 0x0423,
+    0x0503, 0x0511, 0x0505, 0x0c47, 0x0403, 0x0947, 0x0b0b, 0x0887,
+    0x0847, 0x0401, 0x0b03, 0x0817, 0x0aa3, 0x0a13, 0x0853, 0x08a3,
+    0x0a83, 0x082b, 0x0a91, 0x0813, 0x0a03, 0x0a11, 0x0829, 0x08a1,
+    0x0a81, 0x1157, 0x0821, 0x10b3, 0x1463, 0x12c3, 0x1027, 0x1033,
+    0x1293, 0x24ab,
+};
+
+// Returns true if Q != O has order smallprimes[i]. Every intermediate multiple
+// of a point of prime order l is neither O nor the 2-torsion point (0, 0), so
+// such a value ends the check early and also keeps xADD away from its
+// exceptional cases.
+static bool has_prime_order(const proj_point_t A, const proj_point_t Q, size_t i)
+{
+    proj_point_t R[4];
+    proj_point *r0 = R[0], *r1 = R[1], *r2 = R[2], *t = R[3], *u;
+    uint16_t c = order_chains[i];
+    int k = 15;
+
+    while (!(c >> k))
+        k--;
+
+    fp_cpy(Q->X, r0->X);
+    fp_cpy(Q->Z, r0->Z);
+    fp_cpy(Q->X, r2->X);
+    fp_cpy(Q->Z, r2->Z);
+    xDBL(r1, A, Q);
+
+    // (r0, r1, r2) = ([a]Q, [b]Q, [b - a]Q)
+    while (k--)
+    {
+        if (!memcmp(r1->X, zero, sizeof(felm_t)) || !memcmp(r1->Z, zero, sizeof(felm_t)))
+            return false;
+
+        xADD(t, r1, r0, r2);
+        u = r2;
+        if ((c >> k) & 1)
+        {
+            r2 = r1;
+        }
+        else
+        {
+            r2 = r0;
+            r0 = r1;
+        }
+        r1 = t;
+        t = u;
+    }
+    return !memcmp(r1->Z, zero, sizeof(felm_t));
+}
+
+typedef struct validate_state {
+    proj_point_t A;
+    bool proven[SMALL_PRIMES_COUNT];    // primes known to divide the group order
+    UINT512_t order;                    // product of the proven primes
+    int result;                         // 1 (supersingular), 0 (not) or -1 (no proof yet)
+    int decided;                        // set with result: stops the ladders of other threads
+    int spawn_depth;                    // tree levels whose upper half goes to a pool worker
+    pthread_mutex_t lock;               // guards proven, order and result with several threads
+} validate_state;
+
+static int validate_threads = 1;
+
+void csidh_set_validate_threads(int threads)
+{
+    validate_threads = (threads < 1) ? 1 : threads;
+}
+
+static int validate_result(validate_state *s)
+{
+    return __atomic_load_n(&s->result, __ATOMIC_ACQUIRE);
+}
+
+// Records that the leaf of smallprimes[i] has order l (ok) or does not divide p+1 (!ok)
+static void validate_leaf(validate_state *s, size_t i, bool ok)
+{
+    UINT512_t t;
+
+    if (s->spawn_depth > 0)
+        pthread_mutex_lock(&s->lock);
+    if (s->result < 0)
+    {
+        if (!ok)
+            /* P does not have order dividing p+1. */
+            __atomic_store_n(&s->result, 0, __ATOMIC_RELEASE);
+        else
+        {
+            s->proven[i] = true;
+            mp_mul_u64(s->order, smallprimes[i], s->order);
+
+            if (mp_sub_512(four_sqrt_p, s->order, t))
+                /* order > 4 sqrt(p), hence definitely supersingular */
+                __atomic_store_n(&s->result, 1, __ATOMIC_RELEASE);
+        }
+        if (s->result >= 0)
+            __atomic_store_n(&s->decided, 1, __ATOMIC_RELEASE);
+    }
+    if (s->spawn_depth > 0)
+        pthread_mutex_unlock(&s->lock);
+}
+
+static void validate_tree(validate_state *s, proj_point_t *P, const size_t *L, size_t lo, size_t hi, int depth);
+
+#define TASK_QUEUED     0
+#define TASK_RUNNING    1
+#define TASK_DONE       2
+
+typedef struct validate_task {
+    validate_state *s;
+    proj_point_t *P;
+    const size_t *L;
+    size_t lo, mid, hi;
+    int depth;
+    proj_point_t T;         // P[lo] on entry: the caller overwrites P[lo] meanwhile
+    UINT512_t cu;
+    int state;
+    struct validate_task *next;
+} validate_task;
+
+static void validate_upper(validate_task *t)
+{
+    if (xMUL_non_const_stop(t->P[t->mid], t->s->A, t->T, t->cu, &t->s->decided))
+        validate_tree(t->s, t->P, t->L, t->mid, t->hi, t->depth + 1);
+}
+
+// Workers for the upper halves of the tree, shared by all validations. They are
+// started on demand and kept; a caller that finds its task still queued at the
+// join runs it itself, so the walk never waits for a busy pool.
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work, done;
+    validate_task *queue;
+    int workers;
+} vpool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0 };
+
+static pthread_once_t vpool_once = PTHREAD_ONCE_INIT;
+
+static void vpool_prepare(void)
+{
+    pthread_mutex_lock(&vpool.lock);
+}
+
+static void vpool_parent(void)
+{
+    pthread_mutex_unlock(&vpool.lock);
+}
+
+// The child of fork() has none of the workers
+static void vpool_child(void)
+{
+    pthread_mutex_init(&vpool.lock, NULL);
+    pthread_cond_init(&vpool.work, NULL);
+    pthread_cond_init(&vpool.done, NULL);
+    vpool.queue = NULL;
+    vpool.workers = 0;
+}
+
+static void vpool_init(void)
+{
+    pthread_atfork(vpool_prepare, vpool_parent, vpool_child);
+}
+
+static void *vpool_main(void *arg)
+{
+    validate_task *t;
+
+    (void)arg;
+    pthread_mutex_lock(&vpool.lock);
+    for (;;)
+    {
+        while (vpool.queue == NULL)
+            pthread_cond_wait(&vpool.work, &vpool.lock);
+        t = vpool.queue;
+        vpool.queue = t->next;
+        t->state = TASK_RUNNING;
+        pthread_mutex_unlock(&vpool.lock);
+
+        validate_upper(t);
+
+        pthread_mutex_lock(&vpool.lock);
+        t->state = TASK_DONE;
+        pthread_cond_broadcast(&vpool.done);
+    }
+    return NULL;
+}
+
+// Queues t, first growing the pool to the given number of workers
+static void vpool_submit(validate_task *t, int workers)
+{
+    pthread_t tid;
+
+    pthread_once(&vpool_once, vpool_init);
+    pthread_mutex_lock(&vpool.lock);
+    while (vpool.workers < workers && !pthread_create(&tid, NULL, vpool_main, NULL))
+    {
+        pthread_detach(tid);
+        vpool.workers++;
+    }
+    t->state = TASK_QUEUED;
+    t->next = vpool.queue;
+    vpool.queue = t;
+    pthread_cond_signal(&vpool.work);
+    pthread_mutex_unlock(&vpool.lock);
+}
+
+static void vpool_join(validate_task *t)
+{
+    validate_task **q;
+
+    pthread_mutex_lock(&vpool.lock);
+    if (t->state == TASK_QUEUED)
+    {
+        for (q = &vpool.queue; *q != t; q = &(*q)->next);
+        *q = t->next;
+        pthread_mutex_unlock(&vpool.lock);
+        validate_upper(t);
+        return;
+    }
+    while (t->state != TASK_DONE)
+        pthread_cond_wait(&vpool.done, &vpool.lock);
+    pthread_mutex_unlock(&vpool.lock);
+}
 
-/* compute [(p+1)/l] P for all l in our list of primes. */
-/* divide and conquer is much faster than doing it naively,
- * but uses more memory. */
-static void cofactor_multiples(proj_point_t *P, const proj_point_t A, size_t lower, size_t upper)
+/* Walks the product tree of the primes L[lo..hi-1], where P[lo] = [(p+1) / prod L[lo..hi-1]] P,
+ * checking each leaf [(p+1)/l] P with its order chain. The upper, larger primes come first and
+ * the walk stops as soon as the proven order exceeds 4 sqrt(p), so the lower half of the tree
+ * is usually never computed. Up to spawn_depth, the upper half goes to a pool worker while
+ * this thread takes the lower half; nodes and ladders give up once another one has decided. */
+static void validate_tree(validate_state *s, proj_point_t *P, const size_t *L, size_t lo, size_t hi, int depth)
 {
     // Since this function is only called by csidh_validate, it does not need to 
     // be constant-time from the security point of view 
-    assert(lower < upper);  
+    proj_point *A = s->A;
+    UINT512_t cl, cu;
+    size_t i, mid;
 
-    if (upper - lower == 1)
-        return; 
+    /* we only gain information if [(p+1)/l] P is non-zero */
+    if (validate_result(s) >= 0 || !memcmp(P[lo]->Z, zero, sizeof(felm_t)))
+        return;
 
-    size_t mid = lower + (upper - lower + 1) / 2;
+    if (hi - lo == 1)
+    {
+        i = L[lo];
+        validate_leaf(s, i, has_prime_order(A, P[lo], i));
+        return;
+    }
+
+    mid = lo + (hi - lo + 1) / 2;
 
-    UINT512_t cl, cu;
     mp_U512_set_one(cl);
     mp_U512_set_one(cu);
-    for (size_t i = lower; i < mid; ++i)
-        mp_mul_u64(cu, smallprimes[i], cu);
-    for (size_t i = mid; i < upper; ++i)
-        mp_mul_u64(cl, smallprimes[i], cl);
+    for (i = lo; i < mid; ++i)
+        mp_mul_u64(cu, smallprimes[L[i]], cu);
+    for (i = mid; i < hi; ++i)
+        mp_mul_u64(cl, smallprimes[L[i]], cl);
+
+    if (depth < s->spawn_depth)
+    {
+        validate_task t = { s, P, L, lo, mid, hi, depth };
+
+        fp_cpy(P[lo]->X, t.T->X);
+        fp_cpy(P[lo]->Z, t.T->Z);
+        memcpy(t.cu, cu, sizeof(UINT512_t));
+        vpool_submit(&t, (1 << s->spawn_depth) - 1);
+        if (xMUL_non_const_stop(P[lo], A, P[lo], cl, &s->decided))
+            validate_tree(s, P, L, lo, mid, depth + 1);
+        vpool_join(&t);
+        return;
+    }
 
-    xMUL_non_const(P[mid], A, P[lower], cu);
-    xMUL_non_const(P[lower], A, P[lower], cl);
+    // The upper half only uses P[mid..hi-1], so P[lo] is still available for the lower half
+    if (xMUL_non_const_stop(P[mid], A, P[lo], cu, &s->decided))
+        validate_tree(s, P, L, mid, hi, depth + 1);
+    if (validate_result(s) >= 0)
+        return;
 
-    cofactor_multiples(P, A, lower, mid);
-    cofactor_multiples(P, A, mid, upper);
+    if (xMUL_non_const_stop(P[lo], A, P[lo], cl, &s->decided))
+        validate_tree(s, P, L, lo, mid, depth + 1);
 }
 
-bool csidh_validate(const public_key_t in)
+static bool validate_key(const public_key_t in)
 {
     // Since validation does not any secret information, the non-constant time
     // implementation does not seem to expose any vulnerability to the scheme
 
-    proj_point_t A, P[SMALL_PRIMES_COUNT];
-    fp_cpy(in->A, A->X);
-    fp_cpy(one_Mont, A->Z);
+    validate_state s;
+    proj_point_t P[SMALL_PRIMES_COUNT];
+    size_t L[SMALL_PRIMES_COUNT], n, i;
+    UINT512_t k;
+
+    PROFILE_PHASE(PHASE_VALIDATE, -1);
+    fp_cpy(in->A, s.A->X);
+    fp_cpy(one_Mont, s.A->Z);
+    memset(s.proven, 0, sizeof(s.proven));
+    mp_U512_set_one(s.order);
+    s.result = -1;
+    s.decided = 0;
+    // With 2^d threads, the first d levels of the tree spawn
+    for (s.spawn_depth = 0; (2 << s.spawn_depth) <= validate_threads; s.spawn_depth++);
+    if (s.spawn_depth > 0)
+        pthread_mutex_init(&s.lock, NULL);
 
-    UINT512_t order, t;
     do {
-      
+        // A new point keeps the primes proven by the previous ones: the group
+        // then has elements of all these orders, so their product still divides
+        // its order. Only the other primes are searched.
+        mp_U512_set_one(k);
+        for (i = n = 0; i < SMALL_PRIMES_COUNT; ++i)
+        {
+            if (s.proven[i])
+                mp_mul_u64(k, smallprimes[i], k);
+            else
+                L[n++] = i;
+        }
+
         fp_random_512(P[0]->X);
         fp_cpy(one_Mont, P[0]->Z);
-        
+
         /* maximal 2-power in p+1 */
-        xDBL(P[0], A, P[0]);
-        xDBL(P[0], A, P[0]);
+        xDBL(P[0], s.A, P[0]);
+        xDBL(P[0], s.A, P[0]);
+        if (n < SMALL_PRIMES_COUNT)
+            xMUL_non_const(P[0], s.A, P[0], k);
+
+        validate_tree(&s, P, L, 0, n, 0);
+
+    /* P didn't have big enough order to prove supersingularity. */
+    } while (s.result < 0);
+
+    if (s.spawn_depth > 0)
+        pthread_mutex_destroy(&s.lock);
+    PROFILE_PHASE(PHASE_OTHER, -1);
+    return s.result;
+}
+
+// Set-associative cache of validated keys: a key hashes to one set of
+// VALIDATE_CACHE_WAYS slots, replaced with CLOCK, and sets are guarded by
+// VALIDATE_CACHE_SHARDS striped locks. Only valid keys are stored.
+#define VALIDATE_CACHE_WAYS     4
+#define VALIDATE_CACHE_SHARDS   16
+
+typedef struct validate_cache_set {
+    felm_t keys[VALIDATE_CACHE_WAYS];
+    uint8_t used, ref;          // one bit per way
+    uint8_t hand;               // next way examined by CLOCK
+} validate_cache_set;
+
+typedef struct validate_cache {
+    validate_cache_set *sets;
+    size_t nsets;
+    uint64_t seed[2];           // random hash key, so that peers cannot pick colliding keys
+    pthread_mutex_t lock[VALIDATE_CACHE_SHARDS];
+    validate_cache_stats stats;
+} validate_cache;
+
+static validate_cache *vcache = NULL;
 
-        cofactor_multiples(P, A, 0, SMALL_PRIMES_COUNT);
+static size_t validate_cache_index(const validate_cache *c, const felm_t A)
+{
+    uint64_t h = c->seed[0];
+    int i;
+
+    for (i = 0; i < NWORDS_64; i++)
+    {
+        h = (h ^ A[i]) * 0x9e3779b97f4a7c15;
+        h ^= h >> 29;
+    }
+    h = (h ^ c->seed[1]) * 0xbf58476d1ce4e5b9;
+    h ^= h >> 32;
+    return (size_t)(h % c->nsets);
+}
 
-    
-        mp_U512_set_one(order);
+static bool validate_cache_lookup(validate_cache *c, const felm_t A)
+{
+    size_t k = validate_cache_index(c, A);
+    validate_cache_set *set = &c->sets[k];
+    pthread_mutex_t *lock = &c->lock[k % VALIDATE_CACHE_SHARDS];
+    bool hit = false;
+    int w;
 
-        for (size_t i = SMALL_PRIMES_COUNT - 1; i < SMALL_PRIMES_COUNT; --i) {
+    pthread_mutex_lock(lock);
+    for (w = 0; w < VALIDATE_CACHE_WAYS; w++)
+    {
+        if ((set->used >> w & 1) && !memcmp(set->keys[w], A, sizeof(felm_t)))
+        {
+            set->ref |= 1 << w;
+            hit = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(lock);
 
-            /* we only gain information if [(p+1)/l] P is non-zero */
-            if (memcmp(P[i]->Z, zero, sizeof(felm_t))) {
+    __atomic_fetch_add(hit ? &c->stats.hits : &c->stats.misses, 1, __ATOMIC_RELAXED);
+    return hit;
+}
 
-                mp_U512_set_zero(t);
-                t[0] = smallprimes[i];
-                xMUL_non_const(P[i], A, P[i], t);
+static void validate_cache_insert(validate_cache *c, const felm_t A)
+{
+    size_t k = validate_cache_index(c, A);
+    validate_cache_set *set = &c->sets[k];
+    pthread_mutex_t *lock = &c->lock[k % VALIDATE_CACHE_SHARDS];
+    bool evicted = false;
+    int w;
 
-                if (memcmp(P[i]->Z, zero, sizeof(felm_t)))
-                    /* P does not have order dividing p+1. */
-                    return false;
+    pthread_mutex_lock(lock);
+    // Another thread may have validated the same key in the meantime
+    for (w = 0; w < VALIDATE_CACHE_WAYS; w++)
+        if ((set->used >> w & 1) && !memcmp(set->keys[w], A, sizeof(felm_t)))
+            break;
 
-                mp_mul_u64(order, smallprimes[i], order);
+    if (w == VALIDATE_CACHE_WAYS)
+    {
+        for (w = 0; w < VALIDATE_CACHE_WAYS; w++)
+            if (!(set->used >> w & 1))
+                break;
 
-                if (mp_sub_512(four_sqrt_p, order, t))
-                    /* order > 4 sqrt(p), hence definitely supersingular */
-                    return true;
+        if (w == VALIDATE_CACHE_WAYS)
+        {
+            // CLOCK: clear reference bits until a way without one comes up
+            while (set->ref >> set->hand & 1)
+            {
+                set->ref &= ~(1 << set->hand);
+                set->hand = (set->hand + 1) % VALIDATE_CACHE_WAYS;
             }
+            w = set->hand;
+            set->hand = (set->hand + 1) % VALIDATE_CACHE_WAYS;
+            evicted = true;
         }
 
-    /* P didn't have big enough order to prove supersingularity. */
-    } while (1);
+        fp_cpy(A, set->keys[w]);
+        set->used |= 1 << w;
+        set->ref &= ~(1 << w);
+    }
+    pthread_mutex_unlock(lock);
+
+    if (evicted)
+        __atomic_fetch_add(&c->stats.evictions, 1, __ATOMIC_RELAXED);
+}
+
+bool csidh_validate_cache_init(size_t capacity)
+{
+    validate_cache *c;
+    int i;
+
+    csidh_validate_cache_free();
+    if (capacity == 0)
+        return true;
+
+    if ((c = calloc(1, sizeof(validate_cache))) == NULL)
+        return false;
+    c->nsets = (capacity + VALIDATE_CACHE_WAYS - 1) / VALIDATE_CACHE_WAYS;
+    if ((c->sets = calloc(c->nsets, sizeof(validate_cache_set))) == NULL)
+    {
+        free(c);
+        return false;
+    }
+    randombytes(c->seed, sizeof(c->seed));
+    for (i = 0; i < VALIDATE_CACHE_SHARDS; i++)
+        pthread_mutex_init(&c->lock[i], NULL);
+
+    vcache = c;
+    return true;
+}
+
+void csidh_validate_cache_free(void)
+{
+    validate_cache *c = vcache;
+    int i;
+
+    if (c == NULL)
+        return;
+    vcache = NULL;
+    for (i = 0; i < VALIDATE_CACHE_SHARDS; i++)
+        pthread_mutex_destroy(&c->lock[i]);
+    free(c->sets);
+    free(c);
+}
+
+void csidh_validate_cache_stats(validate_cache_stats *stats)
+{
+    validate_cache *c = vcache;
+
+    if (c == NULL)
+    {
+        memset(stats, 0, sizeof(validate_cache_stats));
+        return;
+    }
+    stats->hits = __atomic_load_n(&c->stats.hits, __ATOMIC_RELAXED);
+    stats->misses = __atomic_load_n(&c->stats.misses, __ATOMIC_RELAXED);
+    stats->evictions = __atomic_load_n(&c->stats.evictions, __ATOMIC_RELAXED);
+}
+
+bool csidh_validate(const public_key_t in)
+{
+    validate_cache *c = vcache;
+
+    if (c == NULL)
+        return validate_key(in);
+
+    if (validate_cache_lookup(c, in->A))
+        return true;
+    if (!validate_key(in))
+        return false;
+    validate_cache_insert(c, in->A);
+    return true;
 }
 
 static void get_mont_rhs(const felm_t A, const felm_t x, felm_t rhs)
@@ -101,198 +548,1246 @@ static void get_mont_rhs(const felm_t A, const felm_t x, felm_t rhs)
     fp_mul_mont_512(rhs, x, rhs);
 }
 
-// non-constant and constant-time implementation of action
-static void action(const public_key_t in, const private_key_t priv, public_key_t out)
+// Largest number of keys a worker of csidh_keypair_batch normalizes together
+#define KEYPAIR_CHUNK   8
+
+// Points of full order with the smallest x on the starting curve y^2 = x^3 + x
+// (x = 12) and on its twist (x = 7), in Montgomery form
+static const uint64_t base_x[2][NWORDS_64] = {
+    { 0xc6cc5163eeb48196, 0x36a0b95db9c449c6, 0x75e848145cacb993, 0x59fcb4ddd17c0924,
+      0x567860bac1ec59e6, 0xe2b90918227f9039, 0x67bf4776f4b30f3e, 0x14d74b30662ddb80 },
+    { 0x2c62b6a78fccafd5, 0x166c24c62d88d479, 0x9825c271f03fbe7e, 0xdda8cce418d75a83,
+      0xf54436d03ab09957, 0x0902741635aeaf97, 0x3aca4218bddcef0a, 0x3f0288794af7da40 }
+};
+
+#ifdef _CONSTANT_
+// Number of batch counts covered by base_points
+#define BASE_TABLE_BATCHES  8
+
+// The points P of base_x with the public part of the first round's cofactor
+// for m SIMBA batches applied: entry [m - 1][sign] is the affine x of
+// [4 prod_{i % m != 0} l_i] P in Montgomery form. [0] is [4] P.
+static const uint64_t base_points[BASE_TABLE_BATCHES][2][NWORDS_64] = {
+    {
+        { 0x5cd6dd8d4b773bf5, 0x9dd533ec28e15cfb, 0xffab4adf25aa1cd9, 0x6d5d9d58eeb9f66b,
+          0x132512aace957452, 0xfe3aae0d94ff5373, 0xdeb4b570d5296405, 0x45c51318dd7b93a0 },
+        { 0xc129b9a0e18cd058, 0x2f570f3e981d0e14, 0x91b891e820c68fd2, 0x5fa0c069903d5729,
+          0x84af309b2ed96c33, 0x032a1d129959048b, 0x21dda94227796f57, 0x536694534b1ec4e8 } },
+    {
+        { 0xa186c12c7b5cf931, 0xa3952ca918a54f04, 0xcd828034777f7335, 0x84650b8b636f7d23,
+          0xfa5f796ad9be4c17, 0xb54927ffe8038d9e, 0x15055e38677dc604, 0x247b69eb7e75bbd3 },
+        { 0x2ea65a9fba542597, 0x5577837fe4ebb26e, 0xcc112b07331830ad, 0x98aebbb22e76e094,
+          0xf22abd536f802045, 0x0b9a6da48cdd8cd7, 0xc7e1ddc50c35873e, 0x26726e6ab6b465c1 } },
+    {
+        { 0x30c48c069fc6793a, 0xab371ca2189accf6, 0x19032ddec8a080b3, 0xf16c7766b1b50722,
+          0x302dfbbdb1fffb10, 0xffbebc433ad9489f, 0xd42f8bd8bf1d8fb0, 0x5030b70b36c5f957 },
+        { 0xff3a6287abb8a96a, 0x6ad2f767fcf98293, 0xe07ae5f6b9af0f08, 0x77011830d96cee29,
+          0x31660480f84484b5, 0x6cad09301c6a0760, 0x7eccf92b75d21e77, 0x4054e288f5e705c1 } },
+    {
+        { 0xbb664dc68f4f7153, 0x3795ab0e4953af7d, 0x0b6954f8dcb4c6bc, 0x9dd133fd6bf35e46,
+          0xa8ef808b96bb30a3, 0xc5fab92dd6c704da, 0x2fe82b6c321ed34f, 0x0630e4cb5fc5d942 },
+        { 0xc8c78880c430dab6, 0x648c0b00bc31c131, 0x896a1e775fe9c541, 0x4ebd184ebb8fdc6f,
+          0x6650f9ac66c77174, 0x434a7e3cf505766a, 0x5a56aa25bb30889d, 0x4077286ff88293bd } },
+    {
+        { 0x47de24063a375d79, 0x8e31b062ea566fac, 0x0f9612131ef8754f, 0x822dc725f3e1a19b,
+          0xdec5bd24fc25872d, 0xd87180ae9bb6e493, 0x5b4b67ba9947d69c, 0x02d365467b788072 },
+        { 0xaa6ca31c238f4405, 0x25e495a69a1a3a39, 0x47059b8e57df13f4, 0xec06259bc724a7b1,
+          0x474a4565a34cc249, 0x9ac5a4bc53009de7, 0xcc8a9df02799b2a5, 0x023db085208c1cfe } },
+    {
+        { 0xc41843f1797be9b4, 0x99140780a02770f6, 0x4aabcbd10d3c3aab, 0x93879c9c4dcdea2f,
+          0x64d1c97a3be5ddc4, 0x0a5a5997d16aa2bc, 0x8f35cb3829a642ea, 0x5703a389a278b619 },
+        { 0x8410f560e2343b43, 0xfa2808bf083753af, 0x36c9111c952a5297, 0xae7e38a7c45f6be8,
+          0x37a08df60b34b242, 0x6d6f93acf59cd299, 0x5c6de8a9fad09f52, 0x27525af841300b31 } },
+    {
+        { 0xacba90349146c6da, 0x351b226cc7ff3044, 0x4bd2f37a2593d4ca, 0x8410af7b9fe48c19,
+          0x8a0338c9c677a379, 0xb613c2395c53fa04, 0x91ea95fcf2407d01, 0x58f24552457dbbd0 },
+        { 0x3728bfa93504bc8c, 0x51af74649d0c1f89, 0x55ef985e8b252683, 0x73d566edd51bfb9b,
+          0xd19b516a334b3637, 0x2900d1114f92a9ea, 0xb463cae5d9eacfd7, 0x508551856ec8ddf1 } },
+    {
+        { 0x3374a2c116836bb8, 0x68f8cf2776e682ec, 0x48f43a82effdabbe, 0xe270fddf8c0434f2,
+          0x9647029d49a4193a, 0x63a8778e419d96dd, 0x17e5ea3e4a61a853, 0x4ca9ae18a1f554ee },
+        { 0x9ab60c7431587052, 0xe5ee1146d401fbb0, 0x05feb6ca7c37f496, 0xcccb5782e9947bc4,
+          0x730c0d93cac2cae5, 0x3490c899d3372851, 0x01d43bbdd3310a97, 0x1170381bfae4d2ab } }
+};
+#endif
+
+#ifdef _CONSTANT_
+static int simba_batches = SIMBA_BATCHES;
+
+void csidh_set_simba_batches(int m)
+{
+    if (m < 1)
+        m = 1;
+    if (m > SMALL_PRIMES_COUNT)
+        m = SMALL_PRIMES_COUNT;
+    simba_batches = m;
+}
+
+// Probability that a prime l with exponent MAX_EXPONENT is not finished after
+// the given number of rounds: each round uses the right sign with probability
+// 1/2 (always with dual points) and finds a nontrivial kernel with probability
+// 1 - 1/l
+static double simba_failure(int rounds, uint64_t l, bool dual)
+{
+    double q = (1.0 - 1.0 / (double)l) / (dual ? 1 : 2), term = 1, sum = 0;
+    int k;
+
+    for (k = 0; k < rounds; k++)
+        term *= 1 - q;
+    for (k = 0; k < MAX_EXPONENT && k <= rounds; k++)
+    {
+        sum += term;
+        term *= (double)(rounds - k) / (k + 1) * q / (1 - q);
+    }
+    return sum;
+}
+
+// Rounds of a batch whose smallest prime is l. The bound is the failure
+// probability of the original schedule, l = 3 after UPPER_BOUND + 1 rounds,
+// so a single batch of single-point rounds runs exactly those rounds.
+static int simba_rounds(uint64_t l)
+{
+    double bound = simba_failure(UPPER_BOUND + 1, smallprimes[0], false);
+    int rounds = MAX_EXPONENT;
+#ifdef _DUALPOINT_
+    bool dual = true;
+#else
+    bool dual = false;
+#endif
+
+    while (simba_failure(rounds, l, dual) > bound)
+        rounds++;
+    return rounds;
+}
+#endif
+
+#ifdef _TRACE_ROUNDS_
+static csidh_trace_round trace_ring[CSIDH_TRACE_CAPACITY];
+static uint64_t trace_next = 0;         // records written since the last reset
+static uint32_t trace_actions = 0;
+
+static void trace_push(const csidh_trace_round *r)
+{
+    uint64_t i = __atomic_fetch_add(&trace_next, 1, __ATOMIC_RELAXED);
+
+    trace_ring[i % CSIDH_TRACE_CAPACITY] = *r;
+}
+
+void csidh_trace_reset(void)
+{
+    __atomic_store_n(&trace_next, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&trace_actions, 0, __ATOMIC_RELAXED);
+}
+
+size_t csidh_trace_dump(csidh_trace_round *out, size_t max)
+{
+    uint64_t next = __atomic_load_n(&trace_next, __ATOMIC_ACQUIRE);
+    size_t n = next < CSIDH_TRACE_CAPACITY ? (size_t)next : CSIDH_TRACE_CAPACITY, i;
+
+    if (n > max)
+        n = max;
+    for (i = 0; i < n; i++)
+        out[i] = trace_ring[(next - n + i) % CSIDH_TRACE_CAPACITY];
+    return n;
+}
+
+static int trace_cmp(const void *a, const void *b)
 {
-    UINT512_t k[2] = {{0}};
-    k[0][0] = 4; 
-    k[1][0] = 4;
+    const csidh_trace_round *x = a, *y = b;
+
+    if (x->action != y->action)
+        return x->action < y->action ? -1 : 1;
+    return (x->round > y->round) - (x->round < y->round);
+}
+
+size_t csidh_trace_write(FILE *f)
+{
+    csidh_trace_round *r = malloc(CSIDH_TRACE_CAPACITY * sizeof(csidh_trace_round));
+    size_t n, i;
+
+    if (r == NULL)
+        return 0;
+    n = csidh_trace_dump(r, CSIDH_TRACE_CAPACITY);
+    qsort(r, n, sizeof(csidh_trace_round), trace_cmp);
+
+    fprintf(f, "action,round,batch,sign,real,dummy,failed,done,remaining\n");
+    for (i = 0; i < n; i++)
+        fprintf(f, "%u,%u,%u,%u,%u,%u,%u,%u,%u\n", r[i].action, r[i].round, r[i].batch, r[i].sign,
+                r[i].real, r[i].dummy, r[i].failed, r[i].done, r[i].remaining);
+    free(r);
+    return n;
+}
+
+// used: the exponent asks for the isogeny, zero: its kernel is the point at infinity
+#define TRACE_ISOG(s, used, zero)   ((s)->trace.real += (used) & !(zero), \
+                                     (s)->trace.failed += (used) & (zero), \
+                                     (s)->trace.dummy += !(used))
+#else
+#define TRACE_ISOG(s, used, zero)
+#endif
 
+// State of one action evaluation, so that many of them can run round by round
+typedef struct action_state {
+    proj_point_t A;
     uint8_t e[2][SMALL_PRIMES_COUNT];
+    bool done[2];
+    bool base;                  // next round starts from base_points
+#ifdef _DUALPOINT_
+    struct sign_helper *helper; // thread running the twist ladders, or NULL
+#endif
+#ifdef _CONSTANT_
+    proj_point_t bigA;
+    bool donemask;
+    int batches, batch, left;   // SIMBA schedule: current batch and its remaining rounds
+#else
+    UINT512_t k[2];             // 4 times the primes no longer in use for each sign
+#endif
+#ifdef _TRACE_ROUNDS_
+    csidh_trace_round trace;    // record of the current round
+#endif
+} action_state;
+
+static void action_init(action_state *s, const public_key_t in, const private_key_t priv)
+{
     int8_t t = 0;
-    
+
 #ifdef _CONSTANT_ 
     uint8_t t_sign;
-    bool is_nonzero;
 
     for (size_t i = 0; i < SMALL_PRIMES_COUNT; ++i) 
     {
         t = (int8_t) (priv->exponents[i / 2] << i % 2 * 4) >> 4;
         t_sign = ((t & 0x80) >> 7 | !t);
-        is_nonzero = (bool)t;
 
-        e[t_sign][i] = t - (2 * t_sign) * t;
-        e[!t_sign][i] = 0;
-        mp_mul_u64(k[!t_sign], smallprimes[i], k[!t_sign]);
-        mp_mul_u64(k[!is_nonzero], (smallprimes[i] - ((is_nonzero)*(smallprimes[i]-1))), k[!is_nonzero]);
+        s->e[t_sign][i] = t - (2 * t_sign) * t;
+        s->e[!t_sign][i] = 0;
     }
+    s->donemask = false;
+    s->batches = simba_batches;
+    s->batch = 0;
+    s->left = simba_rounds(smallprimes[0]);
 #else
+    mp_U512_set_zero(s->k[0]);
+    mp_U512_set_zero(s->k[1]);
+    s->k[0][0] = 4; 
+    s->k[1][0] = 4;
+
     for (size_t i = 0; i < SMALL_PRIMES_COUNT; ++i) 
     {
         t = (int8_t) (priv->exponents[i / 2] << i % 2 * 4) >> 4;
 
         if (t > 0) 
         {
-            e[0][i] = t;
-            e[1][i] = 0;
-            mp_mul_u64(k[1], smallprimes[i], k[1]);
+            s->e[0][i] = t;
+            s->e[1][i] = 0;
+            mp_mul_u64(s->k[1], smallprimes[i], s->k[1]);
         }
         else if (t < 0)
         {
-            e[1][i] = -t;
-            e[0][i] = 0;
-            mp_mul_u64(k[0], smallprimes[i], k[0]);
+            s->e[1][i] = -t;
+            s->e[0][i] = 0;
+            mp_mul_u64(s->k[0], smallprimes[i], s->k[0]);
         }
         else 
         {
-            e[0][i] = 0;
-            e[1][i] = 0;
-            mp_mul_u64(k[0], smallprimes[i], k[0]);
-            mp_mul_u64(k[1], smallprimes[i], k[1]);
+            s->e[0][i] = 0;
+            s->e[1][i] = 0;
+            mp_mul_u64(s->k[0], smallprimes[i], s->k[0]);
+            mp_mul_u64(s->k[1], smallprimes[i], s->k[1]);
         }
     }
 #endif
-    proj_point_t A, P; UINT512_t one, cof; felm_t rhs;
-    fp_cpy(in->A, A->X);
-    fp_cpy(one_Mont, A->Z);
+    fp_cpy(in->A, s->A->X);
+    fp_cpy(one_Mont, s->A->Z);
+    s->done[0] = false;
+    s->done[1] = false;
+    s->base = false;
+#ifdef _DUALPOINT_
+    s->helper = NULL;
+#endif
+#ifdef _TRACE_ROUNDS_
+    memset(&s->trace, 0, sizeof(s->trace));
+    s->trace.action = __atomic_fetch_add(&trace_actions, 1, __ATOMIC_RELAXED);
+#endif
+}
+
+#ifdef _CONSTANT_
+// Bit length of a public multiprecision value, at least 1
+static int mp_bitlength(const UINT512_t a)
+{
+    int nbits;
+
+    for (nbits = 512; nbits > 1 && !mp_U512_bit(a, nbits - 1); nbits--);
+    return nbits;
+}
+#endif
 
-    mp_U512_set_one(one);
+// Strategy split: a node over n primes multiplies its point by the largest
+// n - n * ACTION_SPLIT_NUM / ACTION_SPLIT_DEN of them before recursing into the
+// smaller ones, so that few points are pushed through the expensive isogenies
+#ifndef ACTION_SPLIT_NUM
+#define ACTION_SPLIT_NUM    1
+#define ACTION_SPLIT_DEN    4
+#endif
+
+// Q = [prod L[lo..hi-1]] P over the primes still in use for the given sign
+static void strategy_mul(action_state *s, bool sign, proj_point_t Q, proj_point_t P, const size_t *L, size_t lo, size_t hi)
+{
+    UINT512_t cof;
+    size_t i;
 
-    bool  done[2] = {false, false};
+    PROFILE_PHASE(PHASE_LADDER, -1);
+    mp_U512_set_one(cof);
 #ifdef _CONSTANT_
-    int count;
-    bool donemask, sign, mask, esign_mask;
-    proj_point_t bigA, AA, PP, K;
-    unsigned int z_is_zero;
+    UINT512_t bound;
     uint64_t correction;
 
-    for(count = 0; count <= UPPER_BOUND; count++) 
+    // Unused primes are multiplied in as 1; the ladder length only depends on
+    // the product of all of them
+    mp_U512_set_one(bound);
+    for (i = lo; i < hi; i++)
     {
-        fp_cpy(A->X, bigA->X);
-        fp_random_512(P->X);
-        fp_cpy(one_Mont, P->Z);
-        
-        get_mont_rhs(A->X, P->X, rhs);
-        sign = !fp_issquare(rhs);
+        correction = (!s->e[sign][L[i]]) * (smallprimes[L[i]] - 1);
+        mp_mul_u64(cof, (smallprimes[L[i]] - correction), cof);
+        mp_mul_u64(bound, smallprimes[L[i]], bound);
+    }
+    xMUL_bits(Q, s->A, P, cof, mp_bitlength(bound));
+#else
+    for (i = lo; i < hi; i++)
+        if (s->e[sign][L[i]])
+            mp_mul_u64(cof, smallprimes[L[i]], cof);
+    xMUL(Q, s->A, P, cof);
+#endif
+}
 
-        xMUL(P, A, P, k[sign]);
+static size_t strategy_split(size_t lo, size_t hi)
+{
+    size_t mid = lo + (hi - lo) * ACTION_SPLIT_NUM / ACTION_SPLIT_DEN;
 
-        done[sign] = true;
-    
-    
-        for (size_t i = 0; i < SMALL_PRIMES_COUNT; ++i) 
-        {
-            fp_cpy(A->X, AA->X);
-            fp_cpy(A->Z, AA->Z);
-            fp_cpy(P->X, PP->X);
-            fp_cpy(P->Z, PP->Z);
+    return (mid == lo) ? mid + 1 : mid;
+}
 
-            esign_mask = e[sign][i];
-            mp_U512_set_one(cof);
-            for (size_t j = i + 1; j < SMALL_PRIMES_COUNT; ++j)
-            {
-                mask = !e[sign][j];
-                correction = mask * (smallprimes[j] - 1);
-                mp_mul_u64(cof, (smallprimes[j] - correction), cof);
-            }
-            xMUL(K, A, P, cof);
-
-            z_is_zero = !memcmp(K->Z, zero, sizeof(felm_t));
-
-            xISOG(A, P, K, smallprimes[i]);
-            cswap(A, AA, (0 - (uint64_t)(z_is_zero | !esign_mask)));
-            cswap(P, PP, (0 - (uint64_t)(z_is_zero | !esign_mask)));
-
-            mask = (--e[sign][i] | (bool)z_is_zero);
-            mask = (mask | !esign_mask);
-            e[sign][i] += z_is_zero;
-            correction = mask * (smallprimes[i] - 1);
-                
-            mp_mul_u64(k[sign], (smallprimes[i] - correction), k[sign]);
-            done[sign] &= !e[sign][i];
-        }
-
-        fp_inv(A->Z);
-        fp_mul_mont_512(A->X, A->Z, A->X);
-        fp_cpy(one_Mont, A->Z);     
-        donemask ^= donemask;   
-        cswap(A, bigA, (0 - (uint64_t)donemask));
-        donemask = (done[0] & done[1]);
-    } 
-#else
-        do
-        {   
-            fp_random_512(P->X);
-            fp_cpy(one_Mont, P->Z);
-            
-            get_mont_rhs(A->X, P->X, rhs);
-            bool sign = !fp_issquare(rhs);
-            
-            if (done[sign])
-                continue;
-            
-            xMUL(P, A, P, k[sign]);
+#ifdef _DUALPOINT_
+// Latency mode: the ladders of the two directions are independent, so a helper
+// thread runs those of the twist while the calling thread runs those of the curve
+static int action_threads = 1;
 
-            done[sign] = true;
-            for (size_t i = 0; i < SMALL_PRIMES_COUNT; ++i) 
-            {
-                if (e[sign][i]) 
-                {
+void csidh_set_action_threads(int threads)
+{
+    action_threads = (threads >= 2) ? 2 : 1;
+}
 
-                    
-                    mp_U512_set_one(cof);
-                    for (size_t j = i + 1; j < SMALL_PRIMES_COUNT; ++j)
-                        if (e[sign][j])
-                            mp_mul_u64(cof, smallprimes[j], cof);
-                    proj_point_t K;
-                    xMUL(K, A, P, cof);
+#define HELPER_IDLE     0
+#define HELPER_BUSY     1
+#define HELPER_PARKED   2
+#define HELPER_QUIT     3
 
-                    if (memcmp(K->Z, zero, sizeof(felm_t))) {
+typedef struct ladder_job {
+    void (*run)(const struct ladder_job *job);
+    action_state *s;
+    proj_point *Q, *P;
+    const size_t *L;
+    size_t lo, hi;
+    bool table;
+} ladder_job;
 
-                        xISOG(A, P, K, smallprimes[i]);
+typedef struct sign_helper {
+    pthread_t tid;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    ladder_job job;
+    int state;
+} sign_helper;
 
-                        if (!--e[sign][i])
-                            mp_mul_u64(k[sign], smallprimes[i], k[sign]);
+// One helper per calling thread, started by its first latency-mode action and
+// parked between actions
+static pthread_once_t helper_once = PTHREAD_ONCE_INIT;
+static pthread_key_t helper_key;
 
-                    }
+static void helper_wait(const int *state, int value)
+{
+    // Jobs come every few dozen microseconds: spin, but yield now and then so
+    // that the two threads still make progress on a single core
+    int spins = 0;
 
-                }
-                done[sign] &= !e[sign][i];
-            }
-            fp_inv(A->Z);
-            fp_mul_mont_512(A->X, A->Z, A->X);
-            fp_cpy(one_Mont, A->Z);     
+    while (__atomic_load_n(state, __ATOMIC_ACQUIRE) == value)
+    {
+        if (++spins == 1024)
+        {
+            sched_yield();
+            spins = 0;
         }
-        while(!(done[0] && done[1]));
-#endif
-    fp_cpy(A->X, out->A);
+    }
 }
 
-void csidh_keypair(private_key_t priv, public_key_t pub)
+static void *sign_helper_main(void *arg)
 {
-    int i, j;
-    public_key_t base_curve;
-
-    fp_init_zero(base_curve->A);
-    memset(&priv->exponents, 0, sizeof(priv->exponents)); 
+    sign_helper *h = arg;
+    int state;
 
-#ifdef _CONSTANT_
-    for (i = 0; i < SMALL_PRIMES_COUNT; i++) 
+    for (;;)
     {
-        int8_t buf[64];
-        randombytes(buf, sizeof(buf));
-        for (j = 0; j < sizeof(buf); ++j) 
+        helper_wait(&h->state, HELPER_IDLE);
+        if (__atomic_load_n(&h->state, __ATOMIC_ACQUIRE) == HELPER_BUSY)
         {
-            uint8_t compare_mask, full_mask;
-            int8_t compare_lower, compare_upper, new_val, tmp;
+            h->job.run(&h->job);
+            __atomic_store_n(&h->state, HELPER_IDLE, __ATOMIC_RELEASE);
+            continue;
+        }
+        // Between actions the helper sleeps instead of spinning
+        pthread_mutex_lock(&h->lock);
+        while ((state = __atomic_load_n(&h->state, __ATOMIC_ACQUIRE)) == HELPER_PARKED)
+            pthread_cond_wait(&h->wake, &h->lock);
+        pthread_mutex_unlock(&h->lock);
+        if (state == HELPER_QUIT)
+            return NULL;
+    }
+}
 
-            compare_upper = (MAX_EXPONENT + 1) - buf[j];
-            compare_mask = !((compare_upper & 0x80) >> 7 | !compare_upper);
-            compare_lower = buf[j] - (-MAX_EXPONENT - 1);
-            compare_mask &= !((compare_lower & 0x80) >> 7 | !compare_lower);
+// Moves an idle or parked helper to IDLE, PARKED or QUIT
+static void helper_set(sign_helper *h, int state)
+{
+    pthread_mutex_lock(&h->lock);
+    __atomic_store_n(&h->state, state, __ATOMIC_RELEASE);
+    pthread_cond_signal(&h->wake);
+    pthread_mutex_unlock(&h->lock);
+}
+
+static void helper_free(sign_helper *h)
+{
+    pthread_cond_destroy(&h->wake);
+    pthread_mutex_destroy(&h->lock);
+    free(h);
+}
+
+// Stops the helper of an exiting thread
+static void helper_exit(void *arg)
+{
+    sign_helper *h = arg;
+
+    helper_set(h, HELPER_QUIT);
+    pthread_join(h->tid, NULL);
+    helper_free(h);
+}
+
+// The child of fork() has no helper thread: it starts its own when needed
+static void helper_atfork_child(void)
+{
+    pthread_setspecific(helper_key, NULL);
+}
+
+static void helper_init(void)
+{
+    pthread_key_create(&helper_key, helper_exit);
+    pthread_atfork(NULL, NULL, helper_atfork_child);
+}
+
+// The parked helper of the calling thread, or NULL if no thread could be started
+static sign_helper *helper_get(void)
+{
+    sign_helper *h;
+
+    pthread_once(&helper_once, helper_init);
+    h = pthread_getspecific(helper_key);
+    if (h != NULL)
+        return h;
+
+    h = malloc(sizeof(sign_helper));
+    if (h == NULL)
+        return NULL;
+    h->state = HELPER_PARKED;
+    pthread_mutex_init(&h->lock, NULL);
+    pthread_cond_init(&h->wake, NULL);
+    if (pthread_create(&h->tid, NULL, sign_helper_main, h))
+    {
+        helper_free(h);
+        return NULL;
+    }
+    pthread_setspecific(helper_key, h);
+    return h;
+}
+
+static void helper_post(sign_helper *h, const ladder_job *job)
+{
+    h->job = *job;
+    __atomic_store_n(&h->state, HELPER_BUSY, __ATOMIC_RELEASE);
+}
+
+static void helper_join(sign_helper *h)
+{
+    helper_wait(&h->state, HELPER_BUSY);
+}
+
+static void strategy_mul_job(const ladder_job *job)
+{
+    strategy_mul(job->s, 1, job->Q, job->P, job->L, job->lo, job->hi);
+}
+#endif
+
+#ifdef _DUALPOINT_
+// Isogenies of degree smallprimes[L[lo..hi-1]] with the kernel points P[npts - 2]
+// (on the curve) and P[npts - 1] (on the twist): each prime takes its kernel
+// from the point of its exponent's sign. P[0..npts-3] are pushed.
+static __attribute__((noinline)) void action_strategy(action_state *s, proj_point_t *P, size_t npts, const size_t *L, size_t lo, size_t hi)
+{
+    proj_point *A = s->A;
+    size_t i, mid;
+
+    if (hi - lo == 1)
+    {
+        i = L[lo];
+
+        // The sign of the exponent is secret: the kernel is selected with cswap
+        // and both exponent vectors are updated without branches
+        proj_point_t AA, PP[XISOG_MAX_POINTS];
+        bool a0 = s->e[0][i] != 0, a1 = s->e[1][i] != 0, ok;
+        unsigned int z_is_zero;
+        size_t j;
+
+        cswap(P[npts - 2], P[npts - 1], 0 - (uint64_t)!a1);
+
+        fp_cpy(A->X, AA->X);
+        fp_cpy(A->Z, AA->Z);
+        for (j = 0; j + 2 < npts; j++)
+        {
+            fp_cpy(P[j]->X, PP[j]->X);
+            fp_cpy(P[j]->Z, PP[j]->Z);
+        }
+
+        z_is_zero = !memcmp(P[npts - 1]->Z, zero, sizeof(felm_t));
+
+        PROFILE_PHASE((!z_is_zero & (a0 | a1)) ? PHASE_ISOGENY : PHASE_DUMMY, i);
+        xISOG_multi(A, P, npts - 2, P[npts - 1], smallprimes[i]);
+        ok = !z_is_zero & (a0 | a1);
+        TRACE_ISOG(s, a0 | a1, z_is_zero);
+        cswap(A, AA, (0 - (uint64_t)!ok));
+        for (j = 0; j + 2 < npts; j++)
+            cswap(P[j], PP[j], (0 - (uint64_t)!ok));
+
+        s->e[0][i] -= ok & a0;
+        s->e[1][i] -= ok & a1;
+        return;
+    }
+
+    mid = strategy_split(lo, hi);
+
+    // The new pair P[npts], P[npts + 1] generates the kernels of L[lo..mid-1]
+    assert(npts + 1 <= XISOG_MAX_POINTS);
+    if (s->helper != NULL)
+    {
+        ladder_job job = { strategy_mul_job, s, P[npts + 1], P[npts - 1], L, mid, hi, false };
+
+        helper_post(s->helper, &job);
+        strategy_mul(s, 0, P[npts], P[npts - 2], L, mid, hi);
+        helper_join(s->helper);
+    }
+    else
+    {
+        strategy_mul(s, 0, P[npts], P[npts - 2], L, mid, hi);
+        strategy_mul(s, 1, P[npts + 1], P[npts - 1], L, mid, hi);
+    }
+
+    action_strategy(s, P, npts + 2, L, lo, mid);
+    action_strategy(s, P, npts, L, mid, hi);
+}
+#else
+// Isogenies of degree smallprimes[L[lo..hi-1]] for the kernel point P[npts - 1],
+// whose order divides their product. P[0..npts-2] are pushed through each of them.
+static __attribute__((noinline)) void action_strategy(action_state *s, bool sign, proj_point_t *P, size_t npts, const size_t *L, size_t lo, size_t hi)
+{
+    proj_point *A = s->A;
+    size_t i, mid;
+
+    if (hi - lo == 1)
+    {
+        i = L[lo];
+#ifdef _CONSTANT_
+        // Dummy isogeny when the prime is not used or the kernel is trivial
+        proj_point_t AA, PP[XISOG_MAX_POINTS];
+        bool esign_mask = s->e[sign][i];
+        unsigned int z_is_zero;
+        size_t j;
+
+        fp_cpy(A->X, AA->X);
+        fp_cpy(A->Z, AA->Z);
+        for (j = 0; j + 1 < npts; j++)
+        {
+            fp_cpy(P[j]->X, PP[j]->X);
+            fp_cpy(P[j]->Z, PP[j]->Z);
+        }
+
+        z_is_zero = !memcmp(P[npts - 1]->Z, zero, sizeof(felm_t));
+
+        PROFILE_PHASE((z_is_zero | !esign_mask) ? PHASE_DUMMY : PHASE_ISOGENY, i);
+        xISOG_multi(A, P, npts - 1, P[npts - 1], smallprimes[i]);
+        TRACE_ISOG(s, esign_mask, z_is_zero);
+        cswap(A, AA, (0 - (uint64_t)(z_is_zero | !esign_mask)));
+        for (j = 0; j + 1 < npts; j++)
+            cswap(P[j], PP[j], (0 - (uint64_t)(z_is_zero | !esign_mask)));
+
+        s->e[sign][i] -= esign_mask & !z_is_zero;
+#else
+        bool z_is_zero = !memcmp(P[npts - 1]->Z, zero, sizeof(felm_t));
+
+        TRACE_ISOG(s, true, z_is_zero);
+        if (!z_is_zero) {
+
+            PROFILE_PHASE(PHASE_ISOGENY, i);
+            xISOG_multi(A, P, npts - 1, P[npts - 1], smallprimes[i]);
+
+            if (!--s->e[sign][i])
+                mp_mul_u64(s->k[sign], smallprimes[i], s->k[sign]);
+
+        }
+#endif
+        return;
+    }
+
+    mid = strategy_split(lo, hi);
+
+    // P[npts] = [prod L[mid..hi-1]] P[npts - 1] generates the kernels of L[lo..mid-1]
+    assert(npts <= XISOG_MAX_POINTS);
+    strategy_mul(s, sign, P[npts], P[npts - 1], L, mid, hi);
+
+    action_strategy(s, sign, P, npts + 1, L, lo, mid);
+    action_strategy(s, sign, P, npts, L, mid, hi);
+}
+#endif
+
+// Multiplies P by the cofactor of a round for the given sign and fills L with
+// the primes of the round. In constant time, the cofactor is split into the
+// public part 4 prod_{i not in batch} l_i, skipped when P comes from the base
+// table, and the masked product of the batch primes not in use for the sign,
+// whose ladder runs over the bit length of the whole batch.
+// round_point and action_strategy run once per round and are kept out of line:
+// inlined into action_round, GCC 12 reports false -Wstringop overflows on A.
+static __attribute__((noinline)) size_t round_point(action_state *s, bool sign, proj_point_t P, size_t *L, bool table)
+{
+    proj_point *A = s->A;
+    size_t i, n = 0;
+
+    PROFILE_PHASE(PHASE_LADDER, -1);
+#ifdef _CONSTANT_
+    UINT512_t pub, sec, bound;
+    uint64_t correction;
+
+    mp_U512_set_zero(pub);
+    pub[0] = 4;
+    mp_U512_set_one(sec);
+    mp_U512_set_one(bound);
+    for (i = 0; i < SMALL_PRIMES_COUNT; ++i)
+    {
+        if ((int)(i % s->batches) != s->batch)
+        {
+            mp_mul_u64(pub, smallprimes[i], pub);
+            continue;
+        }
+        L[n++] = i;
+        correction = (bool)s->e[sign][i] * (smallprimes[i] - 1);
+        mp_mul_u64(sec, (smallprimes[i] - correction), sec);
+        mp_mul_u64(bound, smallprimes[i], bound);
+    }
+
+    if (!table)
+        xMUL_bits(P, A, P, pub, mp_bitlength(pub));
+    xMUL_bits(P, A, P, sec, mp_bitlength(bound));
+#else
+    (void)table;
+    for (i = 0; i < SMALL_PRIMES_COUNT; ++i)
+        if (s->e[sign][i])
+            L[n++] = i;
+    xMUL(P, A, P, s->k[sign]);
+#endif
+    return n;
+}
+
+#ifdef _DUALPOINT_
+static void round_point_job(const ladder_job *job)
+{
+    // The prime list is the same for both signs
+    size_t L[SMALL_PRIMES_COUNT];
+
+    round_point(job->s, 1, job->P, L, job->table);
+}
+#endif
+
+// Random points on the curve (P[0]) and on its twist (P[1]) from a single
+// Legendre symbol, with Elligator 2: since -1 is a non-square mod p, for
+// u != 0, +-1 exactly one of x = A / (u^2 - 1) and -x - A = -A u^2 / (u^2 - 1)
+// is on the curve. A is affine. Returns the sign of x, a uniformly random bit.
+static bool sample_points(const proj_point_t A, proj_point_t *P)
+{
+    felm_t u2, XZ, t;
+    bool sign;
+
+    if (!memcmp(A->X, zero, sizeof(felm_t)))
+    {
+        // Elligator does not apply to y^2 = x^3 + x, which only occurs as the
+        // public starting curve: sample x at random until both signs are found
+        bool found[2] = {false, false}, first = false;
+        felm_t x, rhs;
+
+        while (!found[0] || !found[1])
+        {
+            fp_random_512(x);
+            get_mont_rhs(A->X, x, rhs);
+            sign = !fp_issquare(rhs);
+            if (!found[0] && !found[1])
+                first = sign;
+            if (!found[sign])
+            {
+                fp_cpy(x, P[sign]->X);
+                fp_cpy(one_Mont, P[sign]->Z);
+                found[sign] = true;
+            }
+        }
+        return first;
+    }
+
+    fp_random_512(u2);
+    fp_sqr_mont_512(u2, u2);
+
+    // (X : Z) = (A : u^2 - 1); its sign is that of X Z (X^2 + A X Z + Z^2)
+    fp_cpy(A->X, P[0]->X);
+    fp_sub_512(u2, one_Mont, P[0]->Z);
+    fp_mul_mont_512(P[0]->X, P[0]->Z, XZ);
+    fp_mul_mont_512(A->X, XZ, t);
+    fp_sqr_mont_512(P[0]->X, P[1]->X);
+    fp_add_512(t, P[1]->X, t);
+    fp_sqr_mont_512(P[0]->Z, P[1]->X);
+    fp_add_512(t, P[1]->X, t);
+    fp_mul_mont_512(t, XZ, t);
+    sign = !fp_issquare(t);
+
+    fp_mul_mont_512(A->X, u2, P[1]->X);
+    fp_sub_512(zero, P[1]->X, P[1]->X);
+    fp_cpy(P[0]->Z, P[1]->Z);
+    cswap(P[0], P[1], 0 - (uint64_t)sign);
+    return sign;
+}
+
+// The first round from the starting curve takes fixed points instead of
+// sampling; returns true if they already carry the public part of the round
+// cofactor (constant-time builds with at most BASE_TABLE_BATCHES batches)
+static bool base_round_points(const action_state *s, proj_point_t *P)
+{
+    fp_cpy(one_Mont, P[0]->Z);
+    fp_cpy(one_Mont, P[1]->Z);
+#ifdef _CONSTANT_
+    if (s->batches <= BASE_TABLE_BATCHES)
+    {
+        fp_cpy(base_points[s->batches - 1][0], P[0]->X);
+        fp_cpy(base_points[s->batches - 1][1], P[1]->X);
+        return true;
+    }
+#else
+    (void)s;
+#endif
+    fp_cpy(base_x[0], P[0]->X);
+    fp_cpy(base_x[1], P[1]->X);
+    return false;
+}
+
+#ifdef _TRACE_ROUNDS_
+// Completes the record of the round that just ran and starts the next one
+static void trace_round(action_state *s, uint8_t sign)
+{
+    csidh_trace_round *r = &s->trace;
+    size_t i;
+
+#ifdef _CONSTANT_
+    r->batch = (uint8_t)s->batch;
+#endif
+    r->sign = sign;
+    r->done = s->done[0] | s->done[1] << 1;
+    r->remaining = 0;
+    for (i = 0; i < SMALL_PRIMES_COUNT; ++i)
+        r->remaining += s->e[0][i] || s->e[1][i];
+    trace_push(r);
+
+    r->round++;
+    r->real = r->dummy = r->failed = 0;
+}
+#endif
+
+// One round of isogenies; leaves A projective
+static void action_round(action_state *s)
+{
+    proj_point *A = s->A;
+    proj_point_t P[XISOG_MAX_POINTS + 1];
+    size_t L[SMALL_PRIMES_COUNT], n = 0, i;
+    bool sign, table = false;
+    uint8_t r;
+
+    PROFILE_PHASE(PHASE_SAMPLING, -1);
+#ifdef _CONSTANT_
+    fp_cpy(A->X, s->bigA->X);
+#endif
+    if (s->base)
+    {
+        table = base_round_points(s, P);
+        s->base = false;
+        // The base points do not provide a random sign
+        randombytes(&r, 1);
+        sign = r & 1;
+    }
+    else
+        sign = sample_points(A, P);
+
+#ifdef _DUALPOINT_
+    // Both signs make progress: one point on the curve, one on the twist
+    if (s->helper != NULL)
+    {
+        ladder_job job = { round_point_job, s, NULL, P[1], NULL, 0, 0, table };
+
+        helper_post(s->helper, &job);
+        n = round_point(s, 0, P[0], L, table);
+        helper_join(s->helper);
+    }
+    else
+    {
+        n = round_point(s, 0, P[0], L, table);
+        round_point(s, 1, P[1], L, table);
+    }
+
+    if (n)
+        action_strategy(s, P, 2, L, 0, n);
+
+    s->done[0] = true;
+    s->done[1] = true;
+    for (i = 0; i < SMALL_PRIMES_COUNT; ++i)
+    {
+        s->done[0] &= !s->e[0][i];
+        s->done[1] &= !s->e[1][i];
+    }
+#else
+#ifndef _CONSTANT_
+    // Never spend a round on a finished sign
+    if (s->done[sign])
+        sign = !sign;
+#endif
+    cswap(P[0], P[1], 0 - (uint64_t)sign);
+    n = round_point(s, sign, P[0], L, table);
+
+    if (n)
+        action_strategy(s, sign, P, 1, L, 0, n);
+
+    s->done[sign] = true;
+    for (i = 0; i < SMALL_PRIMES_COUNT; ++i)
+        s->done[sign] &= !s->e[sign][i];
+#endif
+#ifdef _TRACE_ROUNDS_
+#ifdef _DUALPOINT_
+    trace_round(s, 2);
+#else
+    trace_round(s, sign);
+#endif
+#endif
+#ifdef _CONSTANT_
+    if (!--s->left && ++s->batch < s->batches)
+        s->left = simba_rounds(smallprimes[s->batch]);
+#endif
+}
+
+// Finishes a round once A->Z holds 1/Z
+static void action_normalize(action_state *s)
+{
+    proj_point *A = s->A;
+
+    fp_mul_mont_512(A->X, A->Z, A->X);
+    fp_cpy(one_Mont, A->Z);     
+#ifdef _CONSTANT_
+    s->donemask ^= s->donemask;   
+    cswap(A, s->bigA, (0 - (uint64_t)s->donemask));
+    s->donemask = (s->done[0] & s->done[1]);
+#endif
+}
+
+static bool action_finished(const action_state *s, int count)
+{
+#ifdef _CONSTANT_
+    // Fixed number of rounds per batch
+    (void)count;
+    return s->batch >= s->batches;
+#else
+    (void)count;
+    return s->done[0] && s->done[1];
+#endif
+}
+
+static void action_run(action_state *s)
+{
+    int count;
+#ifdef _DUALPOINT_
+    if (action_threads > 1 && (s->helper = helper_get()) != NULL)
+        helper_set(s->helper, HELPER_IDLE);
+#endif
+
+    for(count = 0; !action_finished(s, count); count++) 
+    {
+        action_round(s);
+        PROFILE_PHASE(PHASE_NORMALIZE, -1);
+        fp_inv(s->A->Z);
+        action_normalize(s);
+    }
+    PROFILE_PHASE(PHASE_OTHER, -1);
+
+#ifdef _DUALPOINT_
+    if (s->helper != NULL)
+    {
+        helper_set(s->helper, HELPER_PARKED);
+        s->helper = NULL;
+    }
+#endif
+}
+
+// Runs n actions in lockstep so that the curves of each round are normalized
+// with a single fp_inv_batch
+static void action_batch(action_state *s, size_t n)
+{
+    felm_t *Z = malloc(n * sizeof(felm_t));
+    size_t *idx = malloc(n * sizeof(size_t));
+    size_t i, m;
+    int count;
+    bool active = true;
+
+    if (Z == NULL || idx == NULL)
+    {
+        free(Z);
+        free(idx);
+        for (i = 0; i < n; i++)
+            action_run(&s[i]);
+        return;
+    }
+
+    for (count = 0; active; count++) 
+    {
+        active = false;
+        m = 0;
+        for (i = 0; i < n; i++)
+        {
+            if (action_finished(&s[i], count))
+                continue;
+            active = true;
+            action_round(&s[i]);
+            fp_cpy(s[i].A->Z, Z[m]);
+            idx[m++] = i;
+        }
+
+        PROFILE_PHASE(PHASE_NORMALIZE, -1);
+        fp_inv_batch(Z, m);
+        for (i = 0; i < m; i++)
+        {
+            fp_cpy(Z[i], s[idx[i]].A->Z);
+            action_normalize(&s[idx[i]]);
+        }
+    }
+    PROFILE_PHASE(PHASE_OTHER, -1);
+
+    free(Z);
+    free(idx);
+}
+
+#if defined(_CONSTANT_) && defined(_FP4_)
+// Four constant-time actions in lockstep on the 4-lane arithmetic. The SIMBA
+// schedule, the primes of each round and the ladder lengths are public and the
+// same in all lanes; only the signs, the exponents and the failed kernels differ,
+// and those are handled with per-lane masks exactly as in action_strategy.
+
+// Q = [prod L[lo..hi-1]] P over the primes still in use for sign[j] in lane j
+static void strategy_mul4(action_state *s, const bool *sign, const proj_point4_t A, proj_point4_t Q, proj_point4_t P, const size_t *L, size_t lo, size_t hi)
+{
+    UINT512_t cof[4], bound;
+    uint64_t correction;
+    size_t i;
+    int j;
+
+    PROFILE_PHASE(PHASE_LADDER, -1);
+    mp_U512_set_one(bound);
+    for (j = 0; j < 4; j++)
+        mp_U512_set_one(cof[j]);
+    for (i = lo; i < hi; i++)
+    {
+        for (j = 0; j < 4; j++)
+        {
+            correction = (!s[j].e[sign[j]][L[i]]) * (smallprimes[L[i]] - 1);
+            mp_mul_u64(cof[j], (smallprimes[L[i]] - correction), cof[j]);
+        }
+        mp_mul_u64(bound, smallprimes[L[i]], bound);
+    }
+    xMUL4_bits(Q, A, P, cof, mp_bitlength(bound));
+}
+
+static bool z4_is_zero(const felm4_t Z, int j)
+{
+    felm_t t;
+
+    fp4_get(Z, j, t);
+    return !memcmp(t, zero, sizeof(felm_t));
+}
+
+// Isogeny of degree smallprimes[i] in all lanes with kernel K, pushing P[0..npts-1];
+// lane j keeps its curve and points when mask[j] is all-ones. Out of line so that
+// the copies stay off the frames of the recursion.
+static __attribute__((noinline)) void isog4_masked(proj_point4_t A, proj_point4_t *P, size_t npts, const proj_point4_t K, size_t i, const uint64_t mask[4])
+{
+    proj_point4_t AA, PP[XISOG_MAX_POINTS];
+    size_t j;
+
+    PROFILE_PHASE(PHASE_ISOGENY, i);
+    fp4_cpy(A->X, AA->X);
+    fp4_cpy(A->Z, AA->Z);
+    for (j = 0; j < npts; j++)
+    {
+        fp4_cpy(P[j]->X, PP[j]->X);
+        fp4_cpy(P[j]->Z, PP[j]->Z);
+    }
+
+    xISOG4_multi(A, P, npts, K, smallprimes[i]);
+    cswap4(A, AA, mask);
+    for (j = 0; j < npts; j++)
+        cswap4(P[j], PP[j], mask);
+}
+
+#ifdef _DUALPOINT_
+static const bool signs4[2][4] = { {0, 0, 0, 0}, {1, 1, 1, 1} };
+
+// action_strategy of dual-point builds in four lanes
+static void action_strategy4(action_state *s, proj_point4_t A, proj_point4_t *P, size_t npts, const size_t *L, size_t lo, size_t hi)
+{
+    size_t i, mid;
+    int j;
+
+    if (hi - lo == 1)
+    {
+        uint64_t mask[4];
+        bool a0[4], a1[4], ok, z_is_zero;
+
+        i = L[lo];
+        for (j = 0; j < 4; j++)
+        {
+            a0[j] = s[j].e[0][i] != 0;
+            a1[j] = s[j].e[1][i] != 0;
+            mask[j] = 0 - (uint64_t)!a1[j];
+        }
+        cswap4(P[npts - 2], P[npts - 1], mask);
+
+        for (j = 0; j < 4; j++)
+        {
+            z_is_zero = z4_is_zero(P[npts - 1]->Z, j);
+            ok = !z_is_zero & (a0[j] | a1[j]);
+            TRACE_ISOG(&s[j], a0[j] | a1[j], z_is_zero);
+            mask[j] = 0 - (uint64_t)!ok;
+            s[j].e[0][i] -= ok & a0[j];
+            s[j].e[1][i] -= ok & a1[j];
+        }
+        isog4_masked(A, P, npts - 2, P[npts - 1], i, mask);
+        return;
+    }
+
+    mid = strategy_split(lo, hi);
+
+    assert(npts + 1 <= XISOG_MAX_POINTS);
+    strategy_mul4(s, signs4[0], A, P[npts], P[npts - 2], L, mid, hi);
+    strategy_mul4(s, signs4[1], A, P[npts + 1], P[npts - 1], L, mid, hi);
+
+    action_strategy4(s, A, P, npts + 2, L, lo, mid);
+    action_strategy4(s, A, P, npts, L, mid, hi);
+}
+#else
+// action_strategy in four lanes; lane j uses the points of sign[j]
+static void action_strategy4(action_state *s, const bool *sign, proj_point4_t A, proj_point4_t *P, size_t npts, const size_t *L, size_t lo, size_t hi)
+{
+    size_t i, mid;
+    int j;
+
+    if (hi - lo == 1)
+    {
+        uint64_t mask[4];
+        bool esign_mask, z_is_zero;
+
+        i = L[lo];
+        for (j = 0; j < 4; j++)
+        {
+            esign_mask = s[j].e[sign[j]][i];
+            z_is_zero = z4_is_zero(P[npts - 1]->Z, j);
+            TRACE_ISOG(&s[j], esign_mask, z_is_zero);
+            mask[j] = 0 - (uint64_t)(z_is_zero | !esign_mask);
+            s[j].e[sign[j]][i] -= esign_mask & !z_is_zero;
+        }
+        isog4_masked(A, P, npts - 1, P[npts - 1], i, mask);
+        return;
+    }
+
+    mid = strategy_split(lo, hi);
+
+    assert(npts <= XISOG_MAX_POINTS);
+    strategy_mul4(s, sign, A, P[npts], P[npts - 1], L, mid, hi);
+
+    action_strategy4(s, sign, A, P, npts + 1, L, lo, mid);
+    action_strategy4(s, sign, A, P, npts, L, mid, hi);
+}
+#endif
+
+// round_point in four lanes: the public part of the cofactor is shared
+static size_t round_point4(action_state *s, const bool *sign, const proj_point4_t A, proj_point4_t P, size_t *L)
+{
+    UINT512_t pub, k[4], sec[4], bound;
+    uint64_t correction;
+    size_t i, n = 0;
+    int j;
+
+    PROFILE_PHASE(PHASE_LADDER, -1);
+    mp_U512_set_zero(pub);
+    pub[0] = 4;
+    mp_U512_set_one(bound);
+    for (j = 0; j < 4; j++)
+        mp_U512_set_one(sec[j]);
+    for (i = 0; i < SMALL_PRIMES_COUNT; ++i)
+    {
+        if ((int)(i % s->batches) != s->batch)
+        {
+            mp_mul_u64(pub, smallprimes[i], pub);
+            continue;
+        }
+        L[n++] = i;
+        for (j = 0; j < 4; j++)
+        {
+            correction = (bool)s[j].e[sign[j]][i] * (smallprimes[i] - 1);
+            mp_mul_u64(sec[j], (smallprimes[i] - correction), sec[j]);
+        }
+        mp_mul_u64(bound, smallprimes[i], bound);
+    }
+
+    for (j = 0; j < 4; j++)
+        memcpy(k[j], pub, sizeof(UINT512_t));
+    xMUL4_bits(P, A, P, k, mp_bitlength(pub));
+    xMUL4_bits(P, A, P, sec, mp_bitlength(bound));
+    return n;
+}
+
+// action_round in four lanes
+static void action_round4(action_state *s)
+{
+    proj_point_t Pj[2];
+    proj_point4_t A, P[XISOG_MAX_POINTS + 1];
+    size_t L[SMALL_PRIMES_COUNT], n, i;
+    bool sign[4];
+    int j;
+
+    PROFILE_PHASE(PHASE_SAMPLING, -1);
+    for (j = 0; j < 4; j++)
+    {
+        fp_cpy(s[j].A->X, s[j].bigA->X);
+        fp4_set(A->X, j, s[j].A->X);
+        fp4_set(A->Z, j, s[j].A->Z);
+        sign[j] = sample_points(s[j].A, Pj);
+#ifdef _DUALPOINT_
+        fp4_set(P[1]->X, j, Pj[1]->X);
+        fp4_set(P[1]->Z, j, Pj[1]->Z);
+#else
+        cswap(Pj[0], Pj[1], 0 - (uint64_t)sign[j]);
+#endif
+        fp4_set(P[0]->X, j, Pj[0]->X);
+        fp4_set(P[0]->Z, j, Pj[0]->Z);
+    }
+
+#ifdef _DUALPOINT_
+    n = round_point4(s, signs4[0], A, P[0], L);
+    round_point4(s, signs4[1], A, P[1], L);
+    if (n)
+        action_strategy4(s, A, P, 2, L, 0, n);
+#else
+    n = round_point4(s, sign, A, P[0], L);
+    if (n)
+        action_strategy4(s, sign, A, P, 1, L, 0, n);
+#endif
+
+    for (j = 0; j < 4; j++)
+    {
+        fp4_get(A->X, j, s[j].A->X);
+        fp4_get(A->Z, j, s[j].A->Z);
+#ifdef _DUALPOINT_
+        s[j].done[0] = true;
+        s[j].done[1] = true;
+        for (i = 0; i < SMALL_PRIMES_COUNT; ++i)
+        {
+            s[j].done[0] &= !s[j].e[0][i];
+            s[j].done[1] &= !s[j].e[1][i];
+        }
+#ifdef _TRACE_ROUNDS_
+        trace_round(&s[j], 2);
+#endif
+#else
+        s[j].done[sign[j]] = true;
+        for (i = 0; i < SMALL_PRIMES_COUNT; ++i)
+            s[j].done[sign[j]] &= !s[j].e[sign[j]][i];
+#ifdef _TRACE_ROUNDS_
+        trace_round(&s[j], sign[j]);
+#endif
+#endif
+        if (!--s[j].left && ++s[j].batch < s[j].batches)
+            s[j].left = simba_rounds(smallprimes[s[j].batch]);
+    }
+}
+
+// Four actions started together share their schedule to the end
+static void action_x4(action_state *s)
+{
+    felm_t Z[4];
+    int j;
+
+    while (!action_finished(&s[0], 0))
+    {
+        action_round4(s);
+        PROFILE_PHASE(PHASE_NORMALIZE, -1);
+        for (j = 0; j < 4; j++)
+            fp_cpy(s[j].A->Z, Z[j]);
+        fp_inv_batch(Z, 4);
+        for (j = 0; j < 4; j++)
+        {
+            fp_cpy(Z[j], s[j].A->Z);
+            action_normalize(&s[j]);
+        }
+    }
+    PROFILE_PHASE(PHASE_OTHER, -1);
+}
+#endif
+
+// non-constant and constant-time implementation of action
+static void action(const public_key_t in, const private_key_t priv, public_key_t out)
+{
+    action_state s;
+
+    action_init(&s, in, priv);
+    action_run(&s);
+    fp_cpy(s.A->X, out->A);
+}
+
+static void keypair_private(private_key_t priv)
+{
+    int i, j;
+
+    memset(&priv->exponents, 0, sizeof(priv->exponents)); 
+
+#ifdef _CONSTANT_
+    for (i = 0; i < SMALL_PRIMES_COUNT; i++) 
+    {
+        int8_t buf[64];
+        randombytes(buf, sizeof(buf));
+        for (j = 0; j < sizeof(buf); ++j) 
+        {
+            uint8_t compare_mask, full_mask;
+            int8_t compare_lower, compare_upper, new_val, tmp;
+
+            compare_upper = (MAX_EXPONENT + 1) - buf[j];
+            compare_mask = !((compare_upper & 0x80) >> 7 | !compare_upper);
+            compare_lower = buf[j] - (-MAX_EXPONENT - 1);
+            compare_mask &= !((compare_lower & 0x80) >> 7 | !compare_lower);
             full_mask = 0 - compare_mask;
 
-            new_val = priv->exponents[i/2] | (buf[j] & 0xf) << i % 2 * 4;     
+            // Replace the nibble: OR-ing every accepted sample pushed it out of range
+            new_val = (priv->exponents[i/2] & (0xf0 >> i % 2 * 4)) | (buf[j] & 0xf) << i % 2 * 4;
             tmp = full_mask & (new_val ^ priv->exponents[i/2]);
             priv->exponents[i/2] = tmp ^ priv->exponents[i/2];
         }
@@ -312,10 +1807,137 @@ void csidh_keypair(private_key_t priv, public_key_t pub)
         }
     }
 #endif
+}
+
+void csidh_keypair(private_key_t priv, public_key_t pub)
+{
+    public_key_t base_curve;
+
+    fp_init_zero(base_curve->A);
+    keypair_private(priv);
+
     // Generate Public-key
     action(base_curve, priv, pub);
 }
 
+void csidh_keypair_fast(private_key_t priv, public_key_t pub)
+{
+    public_key_t base_curve;
+    action_state s;
+
+    fp_init_zero(base_curve->A);
+    keypair_private(priv);
+
+    action_init(&s, base_curve, priv);
+    s.base = true;
+    action_run(&s);
+    fp_cpy(s.A->X, pub->A);
+}
+
+// Keys of one chunk share the per-round inversions of action_batch
+static void keypair_chunk(private_key *priv, public_key *pub, size_t n)
+{
+    action_state *s = malloc(n * sizeof(action_state));
+    public_key_t base_curve;
+    size_t i;
+
+    if (s == NULL)
+    {
+        for (i = 0; i < n; i++)
+            csidh_keypair_fast(&priv[i], &pub[i]);
+        return;
+    }
+
+    fp_init_zero(base_curve->A);
+    for (i = 0; i < n; i++)
+    {
+        keypair_private(&priv[i]);
+        action_init(&s[i], base_curve, &priv[i]);
+        s[i].base = true;
+    }
+    action_batch(s, n);
+    for (i = 0; i < n; i++)
+        fp_cpy(s[i].A->X, pub[i].A);
+
+    free(s);
+}
+
+typedef struct keypair_job {
+    private_key *priv;
+    public_key *pub;
+    size_t n;
+    size_t chunk;
+    size_t next;        // first key not claimed by a worker yet
+} keypair_job;
+
+static void *keypair_worker(void *arg)
+{
+    // Workers claim chunks from the shared counter until the batch is exhausted,
+    // so a slow chunk on one core does not hold back the others
+    keypair_job *job = arg;
+    size_t i, m;
+
+    while ((i = __atomic_fetch_add(&job->next, job->chunk, __ATOMIC_RELAXED)) < job->n)
+    {
+        m = (job->n - i < job->chunk) ? job->n - i : job->chunk;
+        keypair_chunk(job->priv + i, job->pub + i, m);
+    }
+    return NULL;
+}
+
+void csidh_keypair_batch(private_key *priv, public_key *pub, size_t n, int threads)
+{
+    keypair_job job;
+    pthread_t *tid;
+    int i, started = 0;
+
+    if (threads <= 1 || n <= 1)
+    {
+        keypair_chunk(priv, pub, n);
+        return;
+    }
+
+    job.priv = priv;
+    job.pub = pub;
+    job.n = n;
+    job.next = 0;
+    job.chunk = (n + threads - 1) / threads;
+    if (job.chunk > KEYPAIR_CHUNK)
+        job.chunk = KEYPAIR_CHUNK;
+
+    // The calling thread is one of the workers
+    tid = malloc((threads - 1) * sizeof(pthread_t));
+    if (tid != NULL)
+    {
+        for (i = 0; i < threads - 1; i++)
+        {
+            if (pthread_create(&tid[started], NULL, keypair_worker, &job) == 0)
+                started++;
+        }
+    }
+    keypair_worker(&job);
+    for (i = 0; i < started; i++)
+        pthread_join(tid[i], NULL);
+
+    free(tid);
+}
+
+bool csidh_validate_batch(const public_key *in, bool *valid, size_t n)
+{
+    // Validation works on the affine input curve and never inverts, so there
+    // is nothing to normalize across keys: each key runs the early-stopping
+    // product tree of csidh_validate
+    bool all = true;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+    {
+        valid[i] = csidh_validate(&in[i]);
+        all &= valid[i];
+    }
+    return all;
+}
+
 void csidh_sharedsecret(const public_key_t in, const private_key_t priv, shared_secret_t out)
 {
     public_key_t tmp;
@@ -324,3 +1946,290 @@ void csidh_sharedsecret(const public_key_t in, const private_key_t priv, shared_
     fp_cpy(tmp->A, out->A);
 }
 
+void csidh_sharedsecret_batch(const public_key *in, const private_key *priv, shared_secret *out, size_t n)
+{
+    action_state *s = malloc(n * sizeof(action_state));
+    size_t i;
+
+    if (s == NULL)
+    {
+        for (i = 0; i < n; i++)
+            csidh_sharedsecret(&in[i], &priv[i], &out[i]);
+        return;
+    }
+
+    for (i = 0; i < n; i++)
+        action_init(&s[i], &in[i], &priv[i]);
+    action_batch(s, n);
+    for (i = 0; i < n; i++)
+        fp_cpy(s[i].A->X, out[i].A);
+
+    free(s);
+}
+
+void csidh_sharedsecret_x4(const public_key *in, const private_key *priv, shared_secret *out)
+{
+#if defined(_CONSTANT_) && defined(_FP4_)
+    action_state s[4];
+    int j;
+
+    // With the ADX multiplier the batch path is faster
+    if (fp4_preferred())
+    {
+        for (j = 0; j < 4; j++)
+            action_init(&s[j], &in[j], &priv[j]);
+        action_x4(s);
+        for (j = 0; j < 4; j++)
+            fp_cpy(s[j].A->X, out[j].A);
+        return;
+    }
+#endif
+    csidh_sharedsecret_batch(in, priv, out, 4);
+}
+
+////////////////////////// Wire format ///////////////////////////////////////
+
+static void felm_to_bytes(const felm_t t, uint8_t *out)
+{
+    int i, j;
+
+    for (i = 0; i < NWORDS_64; i++)
+        for (j = 0; j < 8; j++)
+            out[8 * i + j] = (uint8_t)(t[i] >> (8 * j));
+}
+
+static void felm_from_bytes(const uint8_t *in, felm_t t)
+{
+    int i, j;
+
+    for (i = 0; i < NWORDS_64; i++)
+    {
+        t[i] = 0;
+        for (j = 0; j < 8; j++)
+            t[i] |= (uint64_t)in[8 * i + j] << (8 * j);
+    }
+}
+
+static void felm_encode(const felm_t a, uint8_t *out)
+{
+    felm_t t;
+
+    from_mont(a, t);
+    felm_to_bytes(t, out);
+}
+
+// Returns false, in constant time, if the value is not below p; out is set either way
+static bool felm_decode(const uint8_t *in, felm_t out)
+{
+    felm_t t, d;
+
+    felm_from_bytes(in, t);
+    to_mont(t, out);
+    return mp_sub_512(t, prime511, d) != 0;
+}
+
+#ifdef _FP4_
+// Multipliers of the 4-lane kernels, which divide by 2^522: 2^10 leaves the
+// Montgomery form, 2^1034 mod p enters it
+static const uint64_t wire_from_mont[NWORDS_64] = { 0x400, 0, 0, 0, 0, 0, 0, 0 };
+static const uint64_t wire_to_mont[NWORDS_64] = { 0x0c973ba28d998afd, 0xce447cb431f4e858,
+                                                   0x9458d6fc63bafda4, 0x5a86997415506193,
+                                                   0xe17db59fb0cc2258, 0x29a34dd348934bea,
+                                                   0x32bbfff6a4da6112, 0x5119203d4a244700 };
+
+static void felm_mul4_setup(felm4_t m4, const uint64_t *m)
+{
+    int j;
+
+    for (j = 0; j < 4; j++)
+        fp4_set_raw(m4, j, m);
+}
+
+// out[j] = in[j] * m / 2^522 mod p, fully reduced, for four 512-bit integers in[j] at once;
+// m4 holds m in every lane
+static void felm_mul4(const uint64_t *in[4], const felm4_t m4, uint64_t *out[4])
+{
+    felm4_t a;
+    felm_t t;
+    uint64_t mask;
+    int i, j;
+
+    for (j = 0; j < 4; j++)
+        fp4_set_raw(a, j, in[j]);
+    fp4_mul_mont_512(a, m4, a);
+    for (j = 0; j < 4; j++)
+    {
+        // The kernel leaves a value below 2p: subtract p unless it borrows
+        fp4_get_raw(a, j, out[j]);
+        mask = 0 - (uint64_t)(mp_sub_512(out[j], prime511, t) != 0);
+        for (i = 0; i < NWORDS_64; i++)
+            out[j][i] = (out[j][i] & mask) | (t[i] & ~mask);
+    }
+}
+
+static void felm_encode4(const uint64_t *a[4], const felm4_t m4, uint8_t *out, size_t stride)
+{
+    felm_t t[4];
+    uint64_t *o[4] = { t[0], t[1], t[2], t[3] };
+    int j;
+
+    felm_mul4(a, m4, o);
+    for (j = 0; j < 4; j++)
+        felm_to_bytes(t[j], out + j * stride);
+}
+
+static void felm_decode4(const uint8_t *in, size_t stride, const felm4_t m4, uint64_t *out[4], bool ok[4])
+{
+    felm_t t[4], d;
+    const uint64_t *p[4] = { t[0], t[1], t[2], t[3] };
+    int j;
+
+    for (j = 0; j < 4; j++)
+    {
+        felm_from_bytes(in + j * stride, t[j]);
+        ok[j] = mp_sub_512(t[j], prime511, d) != 0;
+    }
+    felm_mul4(p, m4, out);
+}
+#endif
+
+void csidh_pub_encode(const public_key_t in, uint8_t out[CSIDH_PUBLIC_KEY_BYTES])
+{
+    felm_encode(in->A, out);
+}
+
+bool csidh_pub_decode(const uint8_t in[CSIDH_PUBLIC_KEY_BYTES], public_key_t out)
+{
+    return felm_decode(in, out->A);
+}
+
+void csidh_priv_encode(const private_key_t in, uint8_t out[CSIDH_PRIVATE_KEY_BYTES])
+{
+    memcpy(out, in->exponents, CSIDH_PRIVATE_KEY_BYTES);
+}
+
+bool csidh_priv_decode(const uint8_t in[CSIDH_PRIVATE_KEY_BYTES], private_key_t out)
+{
+    // Both nibbles of every byte must lie in [-MAX_EXPONENT, MAX_EXPONENT]; no
+    // branch on the secret values
+    uint32_t bad = 0;
+    int i, e;
+
+    for (i = 0; i < CSIDH_PRIVATE_KEY_BYTES; i++)
+    {
+        e = (int8_t)(in[i] << 4) >> 4;
+        bad |= (uint32_t)(MAX_EXPONENT - e) | (uint32_t)(MAX_EXPONENT + e);
+        e = (int8_t)in[i] >> 4;
+        bad |= (uint32_t)(MAX_EXPONENT - e) | (uint32_t)(MAX_EXPONENT + e);
+    }
+    memcpy(out->exponents, in, CSIDH_PRIVATE_KEY_BYTES);
+    return !(bad >> 31);
+}
+
+void csidh_ss_encode(const shared_secret_t in, uint8_t out[CSIDH_SHARED_SECRET_BYTES])
+{
+    felm_encode(in->A, out);
+}
+
+bool csidh_ss_decode(const uint8_t in[CSIDH_SHARED_SECRET_BYTES], shared_secret_t out)
+{
+    return felm_decode(in, out->A);
+}
+
+// The batch functions go through the 4-lane kernels in groups of four when
+// fp4_preferred(), and convert the remainder one element at a time
+void csidh_pub_encode_batch(const public_key *in, uint8_t *out, size_t n)
+{
+    size_t i = 0;
+
+#ifdef _FP4_
+    felm4_t m4;
+
+    if (n >= 4 && fp4_preferred())
+    {
+        felm_mul4_setup(m4, wire_from_mont);
+        for (; i + 4 <= n; i += 4)
+        {
+            const uint64_t *a[4] = { in[i].A, in[i + 1].A, in[i + 2].A, in[i + 3].A };
+            felm_encode4(a, m4, out + i * CSIDH_PUBLIC_KEY_BYTES, CSIDH_PUBLIC_KEY_BYTES);
+        }
+    }
+#endif
+    for (; i < n; i++)
+        felm_encode(in[i].A, out + i * CSIDH_PUBLIC_KEY_BYTES);
+}
+
+bool csidh_pub_decode_batch(const uint8_t *in, public_key *out, bool *ok, size_t n)
+{
+    bool all = true;
+    size_t i = 0;
+
+#ifdef _FP4_
+    felm4_t m4;
+
+    if (n >= 4 && fp4_preferred())
+    {
+        felm_mul4_setup(m4, wire_to_mont);
+        for (; i + 4 <= n; i += 4)
+        {
+            uint64_t *a[4] = { out[i].A, out[i + 1].A, out[i + 2].A, out[i + 3].A };
+            felm_decode4(in + i * CSIDH_PUBLIC_KEY_BYTES, CSIDH_PUBLIC_KEY_BYTES, m4, a, ok + i);
+            all &= ok[i] & ok[i + 1] & ok[i + 2] & ok[i + 3];
+        }
+    }
+#endif
+    for (; i < n; i++)
+    {
+        ok[i] = felm_decode(in + i * CSIDH_PUBLIC_KEY_BYTES, out[i].A);
+        all &= ok[i];
+    }
+    return all;
+}
+
+void csidh_ss_encode_batch(const shared_secret *in, uint8_t *out, size_t n)
+{
+    size_t i = 0;
+
+#ifdef _FP4_
+    felm4_t m4;
+
+    if (n >= 4 && fp4_preferred())
+    {
+        felm_mul4_setup(m4, wire_from_mont);
+        for (; i + 4 <= n; i += 4)
+        {
+            const uint64_t *a[4] = { in[i].A, in[i + 1].A, in[i + 2].A, in[i + 3].A };
+            felm_encode4(a, m4, out + i * CSIDH_SHARED_SECRET_BYTES, CSIDH_SHARED_SECRET_BYTES);
+        }
+    }
+#endif
+    for (; i < n; i++)
+        felm_encode(in[i].A, out + i * CSIDH_SHARED_SECRET_BYTES);
+}
+
+bool csidh_ss_decode_batch(const uint8_t *in, shared_secret *out, bool *ok, size_t n)
+{
+    bool all = true;
+    size_t i = 0;
+
+#ifdef _FP4_
+    felm4_t m4;
+
+    if (n >= 4 && fp4_preferred())
+    {
+        felm_mul4_setup(m4, wire_to_mont);
+        for (; i + 4 <= n; i += 4)
+        {
+            uint64_t *a[4] = { out[i].A, out[i + 1].A, out[i + 2].A, out[i + 3].A };
+            felm_decode4(in + i * CSIDH_SHARED_SECRET_BYTES, CSIDH_SHARED_SECRET_BYTES, m4, a, ok + i);
+            all &= ok[i] & ok[i + 1] & ok[i + 2] & ok[i + 3];
+        }
+    }
+#endif
+    for (; i < n; i++)
+    {
+        ok[i] = felm_decode(in + i * CSIDH_SHARED_SECRET_BYTES, out[i].A);
+        all &= ok[i];
+    }
+    return all;
+}
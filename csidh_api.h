@@ -29,6 +29,11 @@ typedef public_key public_key_t[1];
 
 typedef shared_secret shared_secret_t[1];
 
+// Default number of SIMBA batches of the constant-time action
+#ifndef SIMBA_BATCHES
+#define SIMBA_BATCHES   5
+#endif
+
 ////////////////////////// Main API //////////////////////////////////////////
 /*
 The validate fucntion gets a pointer to the CSIDH public key and return a boolean value
@@ -39,6 +44,33 @@ and it is totally non-constant time.
 */
 bool csidh_validate(const public_key_t in);
 
+/*
+Parallel validation: with 2^d threads (at most), the first d levels of the validation tree run
+their upper halves on a pool of 2^d - 1 workers, started on first use and shared by all
+validations. Whichever leaf completes the proof (or finds a point whose order does not divide
+p+1) ends the walk on all threads, within one ladder step. The default is 1; set it before
+starting any threads.
+*/
+void csidh_set_validate_threads(int threads);
+
+typedef struct validate_cache_stats {
+    uint64_t hits, misses, evictions;
+} validate_cache_stats;
+
+/*
+Optional cache of validated public keys, for servers that see the same peer keys again and
+again. Once enabled, csidh_validate and csidh_validate_batch return immediately for a key
+that was already proven valid. The cache holds up to `capacity` keys (rounded up to a multiple
+of 4) and replaces them with the CLOCK policy; invalid keys are never stored. Lookups are
+thread-safe, but init and free must not run concurrently with validation. Passing 0 or calling
+csidh_validate_cache_free disables the cache. Returns false if the memory cannot be allocated.
+*/
+bool csidh_validate_cache_init(size_t capacity);
+void csidh_validate_cache_free(void);
+
+// Counters since the last csidh_validate_cache_init; all zero without a cache
+void csidh_validate_cache_stats(validate_cache_stats *stats);
+
 /*
 The keypair function generates CSIDH public key and private key for each party. The constant-time
 implementation of this function is included in this library. The generated public key is computed 
@@ -46,6 +78,15 @@ by performing an action on the starting curve. The action operation is implement
 */
 void csidh_keypair(private_key_t priv, public_key_t pub);
 
+/*
+Same keys as csidh_keypair, but the first round on the starting curve takes fixed points of
+full order instead of sampling them; in constant-time builds a precomputed table also holds
+their multiples by the public part of the first round's cofactor, so that round skips most of
+its ladder. Variable-time builds only save the sampling, which costs little, so the fast path
+only helps constant-time builds. csidh_keypair_batch uses this path.
+*/
+void csidh_keypair_fast(private_key_t priv, public_key_t pub);
+
 /*
 The shared secrete generation is basically a wrapper around the action operation which gets 
 Alice's public-key and Bob's private key, or Alice's private key and Bob's public key to generate
@@ -53,4 +94,125 @@ the shared secret using CSIDH for each party. This function is implemented in co
 */
 void csidh_sharedsecret(const public_key_t in, const private_key_t priv, shared_secret_t out);
 
+#ifdef _CONSTANT_
+/*
+The constant-time action splits the primes into m interleaved batches (SIMBA): batch j holds
+the primes smallprimes[i] with i % m == j and is processed alone for a fixed number of rounds,
+which only depends on its smallest prime. The round counts keep the probability of leaving a
+prime unfinished at most that of the original schedule (UPPER_BOUND + 1 rounds over all
+primes), which is what m = 1 runs. The default is SIMBA_BATCHES; set it before starting any
+threads.
+*/
+void csidh_set_simba_batches(int m);
+#endif
+
+#ifdef _DUALPOINT_
+/*
+Latency mode for dual-point builds: with 2 threads, every action started by csidh_keypair,
+csidh_keypair_fast or csidh_sharedsecret runs the ladders of the twist direction on a helper
+thread while the calling thread runs those of the curve direction; the isogenies stay on the
+calling thread. Each calling thread keeps one helper, started by its first such action and
+exited with it. The helper sleeps between actions and spins between the jobs of an action, so
+an action takes more CPU time. The batch API keeps one thread per action. The default is 1;
+set it before starting any threads.
+*/
+void csidh_set_action_threads(int threads);
+#endif
+
+#ifdef _TRACE_ROUNDS_
+/*
+TRACE_ROUNDS=TRUE build: every round of every action appends one record to a global ring buffer
+holding the last CSIDH_TRACE_CAPACITY rounds. The records expose the secret signs and exponents,
+so the instrumented build is not constant-time. TRACE_SUMMARY reads the output of csidh_trace_write.
+*/
+#define CSIDH_TRACE_CAPACITY    65536
+
+typedef struct csidh_trace_round {
+    uint32_t action;        // sequence number of the action
+    uint16_t round;         // round within the action, from 0
+    uint8_t batch;          // SIMBA batch of the round, 0 in variable time
+    uint8_t sign;           // sign of the round's point, 2 for both (dual-point)
+    uint8_t real;           // isogenies computed
+    uint8_t dummy;          // dummy isogenies for primes not in use
+    uint8_t failed;         // kernels that came out with Z = 0
+    uint8_t done;           // done[0] | done[1] << 1 after the round
+    uint8_t remaining;      // primes with a nonzero exponent after the round
+} csidh_trace_round;
+
+// Empties the ring buffer and restarts the action numbering
+void csidh_trace_reset(void);
+
+/*
+Copies up to max of the most recent records, oldest first, and returns their number. Records
+of concurrent actions are interleaved; do not call while actions are running.
+*/
+size_t csidh_trace_dump(csidh_trace_round *out, size_t max);
+
+// Writes the buffered records as CSV sorted by action and round; returns the number of records
+size_t csidh_trace_write(FILE *f);
+#endif
+
+////////////////////////// Batch API /////////////////////////////////////////
+/*
+The batch functions process n independent keys at once. The actions run round by round in
+lockstep, and the projective curves of each round are normalized together with a single
+field inversion (fp_inv_batch) instead of one inversion per curve. Results are the same as
+calling the single-key functions n times.
+*/
+
+/*
+Generates n key pairs on up to `threads` threads (the calling thread included). Workers claim
+chunks of keys from a shared counter, and each chunk is computed with batched normalization.
+*/
+void csidh_keypair_batch(private_key *priv, public_key *pub, size_t n, int threads);
+
+/*
+Validates n public keys; valid[i] receives the result for in[i]. Returns true if all keys are valid.
+*/
+bool csidh_validate_batch(const public_key *in, bool *valid, size_t n);
+
+void csidh_sharedsecret_batch(const public_key *in, const private_key *priv, shared_secret *out, size_t n);
+
+/*
+Four shared secrets per call: out[j] is the secret of in[j] and priv[j]. In constant-time builds with
+the 4-lane arithmetic (felm4_t, AVX2 on x64), the four actions run in lockstep,
+with the same SIMBA schedule and ladder lengths in every lane. Otherwise, and on x64 CPUs with
+BMI2/ADX where the scalar multiplier is faster (fp4_preferred), it is csidh_sharedsecret_batch
+with n = 4.
+*/
+void csidh_sharedsecret_x4(const public_key *in, const private_key *priv, shared_secret *out);
+
+////////////////////////// Wire format ///////////////////////////////////////
+/*
+The key structures hold field elements in Montgomery form. The encodings are canonical: public
+keys and shared secrets are the coefficient A in normal form as 64 little-endian bytes, and
+private keys are the 37 bytes of packed 4-bit exponents. The decoders reject values that are not
+reduced mod p and exponents outside [-MAX_EXPONENT, MAX_EXPONENT]; the range checks of private
+keys and shared secrets run in constant time. The output is written even when the check fails.
+A decoded public key still has to pass csidh_validate.
+*/
+#define CSIDH_PUBLIC_KEY_BYTES      64
+#define CSIDH_PRIVATE_KEY_BYTES     ((SMALL_PRIMES_COUNT + 1) / 2)
+#define CSIDH_SHARED_SECRET_BYTES   64
+
+void csidh_pub_encode(const public_key_t in, uint8_t out[CSIDH_PUBLIC_KEY_BYTES]);
+bool csidh_pub_decode(const uint8_t in[CSIDH_PUBLIC_KEY_BYTES], public_key_t out);
+
+void csidh_priv_encode(const private_key_t in, uint8_t out[CSIDH_PRIVATE_KEY_BYTES]);
+bool csidh_priv_decode(const uint8_t in[CSIDH_PRIVATE_KEY_BYTES], private_key_t out);
+
+void csidh_ss_encode(const shared_secret_t in, uint8_t out[CSIDH_SHARED_SECRET_BYTES]);
+bool csidh_ss_decode(const uint8_t in[CSIDH_SHARED_SECRET_BYTES], shared_secret_t out);
+
+/*
+Batch conversions of n keys stored back to back, CSIDH_PUBLIC_KEY_BYTES or
+CSIDH_SHARED_SECRET_BYTES apart. The decoders store the check of key i in ok[i] and return
+true if all keys are canonical. On x64 without BMI2/ADX, groups of four go through the AVX2
+multiplier (fp4_preferred).
+*/
+void csidh_pub_encode_batch(const public_key *in, uint8_t *out, size_t n);
+bool csidh_pub_decode_batch(const uint8_t *in, public_key *out, bool *ok, size_t n);
+void csidh_ss_encode_batch(const shared_secret *in, uint8_t *out, size_t n);
+bool csidh_ss_decode_batch(const uint8_t *in, shared_secret *out, bool *ok, size_t n);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,340 @@
+/****************************************************************************
+*   Efficient implementation of finite field arithmetic over p511 on ARMv8
+*                   Constant-time Implementation of CSIDH
+*
+*   Benchmark suite: field, group and protocol operations
+*
+*   BENCH [--json FILE] [--timer auto|perf|counter|clock] [--filter NAME]
+*         [--hist] [--budget MS] [--warmup MS] [--seed N]
+*****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "arith.h"
+#include "csidh_api.h"
+#include "rng.h"
+#include "bench.h"
+
+typedef struct field_ctx {
+    felm_t a, b, c;
+    felm_t v[64];
+    UINT512_t m;
+} field_ctx;
+
+typedef struct group_ctx {
+    proj_point_t A, A24, P, Q, R, S, K;
+    proj_point_t pts[4];
+    UINT512_t k;
+    uint64_t degree;
+    int nbits;
+} group_ctx;
+
+typedef struct protocol_ctx {
+    public_key_t pub, peer;
+    private_key_t priv;
+    shared_secret_t ss;
+    public_key peers[4];
+    private_key privs[4];
+    shared_secret sss[4];
+} protocol_ctx;
+
+#ifdef _FP4_
+typedef struct lanes_ctx {
+    felm4_t a, b;
+    proj_point4_t A, A24, P, Q, PQ, K;
+    proj_point4_t pts[4];
+} lanes_ctx;
+#endif
+
+static void b_fp_random(void *p) { field_ctx *c = p; fp_random_512(c->c); }
+static void b_fp_add(void *p) { field_ctx *c = p; fp_add_512(c->a, c->b, c->a); }
+static void b_fp_sub(void *p) { field_ctx *c = p; fp_sub_512(c->a, c->b, c->a); }
+static void b_fp_mul(void *p) { field_ctx *c = p; fp_mul_mont_512(c->a, c->b, c->a); }
+static void b_fp_sqr(void *p) { field_ctx *c = p; fp_sqr_mont_512(c->a, c->a); }
+static void b_fp_inv(void *p) { field_ctx *c = p; fp_inv(c->a); }
+static void b_fp_issquare(void *p) { field_ctx *c = p; c->a[0] ^= fp_issquare(c->a); }
+static void b_fp_inv_batch(void *p) { field_ctx *c = p; fp_inv_batch(c->v, 64); }
+static void b_to_mont(void *p) { field_ctx *c = p; to_mont(c->c, c->c); }
+static void b_from_mont(void *p) { field_ctx *c = p; from_mont(c->c, c->c); }
+static void b_mp_add(void *p) { field_ctx *c = p; mp_add_512(c->a, c->b, c->c); }
+static void b_mp_sub(void *p) { field_ctx *c = p; mp_sub_512(c->a, c->b, c->c); }
+static void b_mp_mul_u64(void *p) { field_ctx *c = p; mp_mul_u64(c->m, 587, c->m); }
+
+static void b_cswap(void *p) { group_ctx *g = p; cswap(g->P, g->Q, g->k[0] & 1 ? ~0ULL : 0); }
+static void b_xdbl(void *p) { group_ctx *g = p; xDBL(g->P, g->A, g->P); }
+static void b_xadd(void *p) { group_ctx *g = p; xADD(g->S, g->P, g->Q, g->R); }
+static void b_xdbladd(void *p) { group_ctx *g = p; xDBLADD(g->R, g->S, g->P, g->Q, g->pts[0], g->A24); }
+static void b_xmul(void *p) { group_ctx *g = p; xMUL(g->Q, g->A, g->P, g->k); }
+static void b_xmul_non_const(void *p) { group_ctx *g = p; xMUL_non_const(g->Q, g->A, g->P, g->k); }
+static void b_xmul_bits(void *p) { group_ctx *g = p; xMUL_bits(g->Q, g->A, g->P, g->k, g->nbits); }
+static void b_xisog(void *p) { group_ctx *g = p; xISOG(g->A, g->P, g->K, g->degree); }
+static void b_xisog_multi(void *p) { group_ctx *g = p; xISOG_multi(g->A, g->pts, 4, g->K, g->degree); }
+
+static void b_keypair(void *p) { protocol_ctx *c = p; csidh_keypair(c->priv, c->pub); }
+static void b_keypair_fast(void *p) { protocol_ctx *c = p; csidh_keypair_fast(c->priv, c->pub); }
+static void b_validate(void *p) { protocol_ctx *c = p; csidh_validate(c->peer); }
+static void b_sharedsecret(void *p) { protocol_ctx *c = p; csidh_sharedsecret(c->peer, c->priv, c->ss); }
+static void b_sharedsecret_x4(void *p) { protocol_ctx *c = p; csidh_sharedsecret_x4(c->peers, c->privs, c->sss); }
+
+#ifdef _FP4_
+static void b_fp4_add(void *p) { lanes_ctx *c = p; fp4_add_512(c->a, c->b, c->a); }
+static void b_fp4_sub(void *p) { lanes_ctx *c = p; fp4_sub_512(c->a, c->b, c->a); }
+static void b_fp4_mul(void *p) { lanes_ctx *c = p; fp4_mul_mont_512(c->a, c->b, c->a); }
+static void b_xdbladd4(void *p) { lanes_ctx *c = p; xDBLADD4(c->P, c->Q, c->P, c->Q, c->PQ, c->A24); }
+static void b_xisog4_multi(void *p) { lanes_ctx *c = p; xISOG4_multi(c->A, c->pts, 4, c->K, 587); }
+#endif
+
+static void random_mont(felm_t a)
+{
+    fp_random_512(a);
+    to_mont(a, a);
+}
+
+static void random_point(proj_point_t P)
+{
+    random_mont(P->X);
+    random_mont(P->Z);
+}
+
+static void field_bench(bench_config *cfg)
+{
+    field_ctx c;
+    int i;
+
+    random_mont(c.a);
+    random_mont(c.b);
+    random_mont(c.c);
+    for (i = 0; i < 64; i++)
+        random_mont(c.v[i]);
+    mp_U512_set_one(c.m);
+
+    bench_section(cfg, "Field arithmetic");
+    bench_run(cfg, "fp_random_512", b_fp_random, &c);
+    bench_run(cfg, "fp_add_512", b_fp_add, &c);
+    bench_run(cfg, "fp_sub_512", b_fp_sub, &c);
+    bench_run(cfg, "fp_mul_mont_512", b_fp_mul, &c);
+    bench_run(cfg, "fp_sqr_mont_512", b_fp_sqr, &c);
+    bench_run(cfg, "fp_inv", b_fp_inv, &c);
+    bench_run(cfg, "fp_issquare", b_fp_issquare, &c);
+    bench_run(cfg, "fp_inv_batch (n = 64)", b_fp_inv_batch, &c);
+    bench_run(cfg, "to_mont", b_to_mont, &c);
+    bench_run(cfg, "from_mont", b_from_mont, &c);
+    bench_run(cfg, "mp_add_512", b_mp_add, &c);
+    bench_run(cfg, "mp_sub_512", b_mp_sub, &c);
+    bench_run(cfg, "mp_mul_u64", b_mp_mul_u64, &c);
+}
+
+static void group_bench(bench_config *cfg)
+{
+    static const uint64_t degrees[4] = {3, 101, 373, 587};
+    char name[64];
+    group_ctx g;
+    int i;
+
+    // y^2 = x^3 + x with random points: the formulas do not depend on the orders
+    fp_init_zero(g.A->X);
+    fp_cpy(one_Mont, g.A->Z);
+    fp_add_512(g.A->Z, g.A->Z, g.A24->X);
+    fp_add_512(g.A24->X, g.A24->X, g.A24->Z);
+    random_point(g.P);
+    random_point(g.Q);
+    random_point(g.R);
+    random_point(g.K);
+    for (i = 0; i < 4; i++)
+        random_point(g.pts[i]);
+    for (i = 0; i < NWORDS_64; i++)
+        g.k[i] = ((uint64_t)rand() << 33) ^ ((uint64_t)rand() << 11) ^ (uint64_t)rand();
+    g.k[NWORDS_64 - 1] >>= 1;
+    g.nbits = 511;
+
+    bench_section(cfg, "Group operations");
+    bench_run(cfg, "cswap", b_cswap, &g);
+    bench_run(cfg, "xDBL", b_xdbl, &g);
+    bench_run(cfg, "xADD", b_xadd, &g);
+    bench_run(cfg, "xDBLADD", b_xdbladd, &g);
+    bench_run(cfg, "xMUL (511 bits)", b_xmul, &g);
+    bench_run(cfg, "xMUL_non_const (511 bits)", b_xmul_non_const, &g);
+    bench_run(cfg, "xMUL_bits (511 bits)", b_xmul_bits, &g);
+    for (i = 0; i < 4; i++)
+    {
+        g.degree = degrees[i];
+        snprintf(name, sizeof(name), "xISOG (l = %d)", (int)degrees[i]);
+        bench_run(cfg, name, b_xisog, &g);
+    }
+    g.degree = 587;
+    bench_run(cfg, "xISOG_multi (l = 587, 4 points)", b_xisog_multi, &g);
+}
+
+#ifdef _FP4_
+static void random_point4(proj_point4_t P)
+{
+    felm_t t;
+    int j;
+
+    for (j = 0; j < 4; j++)
+    {
+        random_mont(t);
+        fp4_set(P->X, j, t);
+        random_mont(t);
+        fp4_set(P->Z, j, t);
+    }
+}
+
+static void lanes_bench(bench_config *cfg, const char *kernels)
+{
+    lanes_ctx c;
+    char name[64];
+    int i;
+
+    // Same curve as group_bench in every lane
+    random_point4(c.P);
+    fp4_cpy(c.P->X, c.a);
+    fp4_cpy(c.P->Z, c.b);
+    fp4_set_zero(c.A->X);
+    fp4_set_one(c.A->Z);
+    fp4_add_512(c.A->Z, c.A->Z, c.A24->X);
+    fp4_add_512(c.A24->X, c.A24->X, c.A24->Z);
+    random_point4(c.Q);
+    random_point4(c.PQ);
+    random_point4(c.K);
+    for (i = 0; i < 4; i++)
+        random_point4(c.pts[i]);
+
+    snprintf(name, sizeof(name), "4-lane %s arithmetic (4 elements per call)", kernels);
+    bench_section(cfg, name);
+    snprintf(name, sizeof(name), "fp4_add_512 (%s)", kernels);
+    bench_run(cfg, name, b_fp4_add, &c);
+    snprintf(name, sizeof(name), "fp4_sub_512 (%s)", kernels);
+    bench_run(cfg, name, b_fp4_sub, &c);
+    snprintf(name, sizeof(name), "fp4_mul_mont_512 (%s)", kernels);
+    bench_run(cfg, name, b_fp4_mul, &c);
+    snprintf(name, sizeof(name), "xDBLADD4 (%s)", kernels);
+    bench_run(cfg, name, b_xdbladd4, &c);
+    snprintf(name, sizeof(name), "xISOG4_multi (%s, l = 587, 4 points)", kernels);
+    bench_run(cfg, name, b_xisog4_multi, &c);
+}
+#endif
+
+static void protocol_bench(bench_config *cfg)
+{
+    protocol_ctx c;
+    int i;
+
+    csidh_keypair(c.priv, c.peer);
+    csidh_keypair(c.priv, c.pub);
+    for (i = 0; i < 4; i++)
+    {
+        c.peers[i] = c.peer[0];
+        c.privs[i] = c.priv[0];
+    }
+
+    bench_section(cfg, "CSIDH-512 protocol");
+    bench_run(cfg, "csidh_keypair", b_keypair, &c);
+    bench_run(cfg, "csidh_keypair_fast", b_keypair_fast, &c);
+    bench_run(cfg, "csidh_validate", b_validate, &c);
+    bench_run(cfg, "csidh_sharedsecret", b_sharedsecret, &c);
+    bench_run(cfg, "csidh_sharedsecret_x4 (4 secrets)", b_sharedsecret_x4, &c);
+}
+
+static const char *build_name(void)
+{
+    return
+#if defined(_X64_)
+        "x64"
+#elif defined(_GENERIC_)
+        "generic"
+#else
+        "ARMv8"
+#endif
+#ifdef _CONSTANT_
+        " constant-time"
+#else
+        " variable-time"
+#endif
+#ifdef _FASTLADDER_
+        " fastladder"
+#endif
+#ifdef _DUALPOINT_
+        " dualpoint"
+#endif
+#ifdef _SAFEGCD_
+        " safegcd"
+#endif
+#ifdef _LAZY_REDUCTION_
+        " lazy"
+#endif
+        ;
+}
+
+static chacha20_drbg_t seeded_drbg;
+
+int main(int argc, char *argv[])
+{
+    bench_config cfg = { BENCH_TIMER_AUTO, 100, 1000, 11, 1001, 0.05, NULL, false, NULL, build_name() };
+    const char *json = NULL;
+    uint8_t seed[32] = {0};
+    uint64_t s;
+    int i, j;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--hist"))
+            cfg.hist = true;
+        else if (i + 1 < argc && !strcmp(argv[i], "--json"))
+            json = argv[++i];
+        else if (i + 1 < argc && !strcmp(argv[i], "--filter"))
+            cfg.filter = argv[++i];
+        else if (i + 1 < argc && !strcmp(argv[i], "--budget"))
+            cfg.budget_ms = atof(argv[++i]);
+        else if (i + 1 < argc && !strcmp(argv[i], "--warmup"))
+            cfg.warmup_ms = atof(argv[++i]);
+        else if (i + 1 < argc && !strcmp(argv[i], "--timer"))
+        {
+            i++;
+            if (!strcmp(argv[i], "perf"))
+                cfg.timer = BENCH_TIMER_PERF;
+            else if (!strcmp(argv[i], "counter"))
+                cfg.timer = BENCH_TIMER_COUNTER;
+            else if (!strcmp(argv[i], "clock"))
+                cfg.timer = BENCH_TIMER_CLOCK;
+        }
+        else if (i + 1 < argc && !strcmp(argv[i], "--seed"))
+        {
+            // Keys and points from a seeded DRBG, so that runs can be compared
+            s = strtoull(argv[++i], NULL, 0);
+            for (j = 0; j < 8; j++)
+                seed[j] = (uint8_t)(s >> (8 * j));
+            chacha20_drbg_init(&seeded_drbg, seed);
+            rng_set_callback(chacha20_drbg_randombytes, &seeded_drbg);
+            srand((unsigned int)s);
+        }
+        else
+        {
+            printf("usage: %s [--json FILE] [--timer auto|perf|counter|clock] [--filter NAME]\n"
+                   "       [--hist] [--budget MS] [--warmup MS] [--seed N]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (json != NULL && (cfg.json = fopen(json, "w")) == NULL)
+    {
+        perror(json);
+        return 1;
+    }
+
+    bench_timer_init(cfg.timer);
+    bench_begin(&cfg, "BENCHMARKING CSIDH_P511");
+    printf("Build: %s\n", cfg.build);
+    field_bench(&cfg);
+    group_bench(&cfg);
+#if defined(_X64_)
+    if (fp4_available())
+        lanes_bench(&cfg, "AVX2");
+#endif
+    protocol_bench(&cfg);
+    bench_end(&cfg);
+
+    if (cfg.json != NULL)
+        fclose(cfg.json);
+    return 0;
+}
@@ -1,18 +1,23 @@
 #include "arith.h"
 #include "csidh_api.h"
+#include "rng.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #define BENCH_COUNT     1
 #define TEST_COUNT      1
+#define BATCH_COUNT     4
+#define TRACE_COUNT     16
 
 int64_t cpucycles(void)
 { // Access system counter for benchmarking
     struct timespec time;
 
-    clock_gettime(CLOCK_REALTIME, &time);
+    clock_gettime(CLOCK_MONOTONIC, &time);
     return (int64_t)(time.tv_sec*1e9 + time.tv_nsec);
 }
 
@@ -83,6 +88,469 @@ int csidh_test()
     return 1;   // PASSED    
 }
 
+int csidh_batch_test()
+{ // Batched keypair/validation/shared secrets must agree with the single-key API
+    int i;
+    public_key alice_pub[BATCH_COUNT], bob_pub[BATCH_COUNT];
+    private_key alice_priv[BATCH_COUNT], bob_priv[BATCH_COUNT];
+    shared_secret alice_shared[BATCH_COUNT], bob_shared[BATCH_COUNT];
+    shared_secret_t single;
+    bool valid[BATCH_COUNT];
+    bool passed = true;
+
+    csidh_keypair_batch(alice_priv, alice_pub, BATCH_COUNT, 1);
+    csidh_keypair_batch(bob_priv, bob_pub, BATCH_COUNT, 2);
+
+    passed &= csidh_validate_batch(alice_pub, valid, BATCH_COUNT);
+    passed &= csidh_validate_batch(bob_pub, valid, BATCH_COUNT);
+
+    csidh_sharedsecret_batch(bob_pub, alice_priv, alice_shared, BATCH_COUNT);
+    csidh_sharedsecret_batch(alice_pub, bob_priv, bob_shared, BATCH_COUNT);
+    for(i = 0; i < BATCH_COUNT; i++)
+    {
+        if(memcmp(alice_shared[i].A, bob_shared[i].A, NWORDS_64 * 8) != 0)
+            passed = false;
+    }
+
+    csidh_sharedsecret(&bob_pub[0], &alice_priv[0], single);
+    if(memcmp(single->A, alice_shared[0].A, NWORDS_64 * 8) != 0)
+        passed = false;
+
+    if (passed == true)
+        printf("\n   Batch API............................................PASSED");
+    else
+        printf("\n   Batch API............................................FAILED");
+
+    return passed;
+}
+
+int csidh_x4_test()
+{ // Four shared secrets per call must agree with the single-key API
+    int i;
+    public_key alice_pub[4], bob_pub[4];
+    private_key alice_priv[4], bob_priv[4];
+    shared_secret alice_shared[4], bob_shared[4];
+    shared_secret_t single;
+    bool passed = true;
+#if defined(_X64_)
+    bool adx;
+#endif
+
+    csidh_keypair_batch(alice_priv, alice_pub, 4, 1);
+    csidh_keypair_batch(bob_priv, bob_pub, 4, 1);
+
+    csidh_sharedsecret_x4(bob_pub, alice_priv, alice_shared);
+#if defined(_X64_)
+    // Bob without the ADX multiplier, where the 4-lane path runs even on ADX CPUs
+    adx = fp_backend_has_adx();
+    fp_backend_use_adx(false);
+#endif
+    csidh_sharedsecret_x4(alice_pub, bob_priv, bob_shared);
+#if defined(_X64_)
+    fp_backend_use_adx(adx);
+#endif
+    for(i = 0; i < 4; i++)
+    {
+        csidh_sharedsecret(&bob_pub[i], &alice_priv[i], single);
+        if(memcmp(alice_shared[i].A, bob_shared[i].A, NWORDS_64 * 8) != 0 ||
+           memcmp(single->A, alice_shared[i].A, NWORDS_64 * 8) != 0)
+            passed = false;
+    }
+
+    if (passed == true)
+        printf("\n   Four-lane shared secret..............................PASSED");
+    else
+        printf("\n   Four-lane shared secret..............................FAILED");
+
+    return passed;
+}
+
+int csidh_invalid_key_test()
+{ // Random curves are ordinary with overwhelming probability and must be rejected
+    int i;
+    public_key keys[BATCH_COUNT];
+    private_key_t priv;
+    bool valid[BATCH_COUNT];
+    bool passed = true;
+
+    fp_init_zero(keys[0].A);
+    passed &= csidh_validate(&keys[0]);
+    for(i = 0; i < TEST_COUNT; i++)
+    {
+        fp_random_512(keys[0].A);
+        passed &= !csidh_validate(&keys[0]);
+    }
+
+    // One ordinary curve among valid keys
+    for(i = 0; i < BATCH_COUNT; i++)
+        csidh_keypair(priv, &keys[i]);
+    fp_random_512(keys[BATCH_COUNT / 2].A);
+    passed &= !csidh_validate_batch(keys, valid, BATCH_COUNT);
+    for(i = 0; i < BATCH_COUNT; i++)
+        passed &= valid[i] == (i != BATCH_COUNT / 2);
+
+    if (passed == true)
+        printf("\n   Invalid Public-key rejection.........................PASSED");
+    else
+        printf("\n   Invalid Public-key rejection.........................FAILED");
+
+    return passed;
+}
+
+int csidh_parallel_validate_test()
+{ // Every thread count must give the single-thread answers
+    int t;
+    public_key_t base, pub, invalid;
+    private_key_t priv;
+    bool passed = true;
+
+    fp_init_zero(base->A);
+    csidh_keypair(priv, pub);
+    fp_random_512(invalid->A);
+    for(t = 2; t <= 8; t *= 2)
+    {
+        csidh_set_validate_threads(t);
+        passed &= csidh_validate(base);
+        passed &= csidh_validate(pub);
+        passed &= !csidh_validate(invalid);
+    }
+    csidh_set_validate_threads(1);
+
+    if (passed == true)
+        printf("\n   Parallel validation..................................PASSED");
+    else
+        printf("\n   Parallel validation..................................FAILED");
+
+    return passed;
+}
+
+int csidh_validate_cache_test()
+{ // A cache of 4 keys is a single CLOCK set: the fifth valid key evicts one
+    int i;
+    public_key keys[BATCH_COUNT + 1];
+    private_key priv[BATCH_COUNT];
+    public_key_t invalid;
+    validate_cache_stats st;
+    bool passed = true;
+
+    fp_init_zero(keys[0].A);
+    csidh_keypair_batch(priv, &keys[1], BATCH_COUNT, 1);
+    fp_random_512(invalid->A);
+
+    passed &= csidh_validate_cache_init(4);
+    passed &= csidh_validate(&keys[0]);
+    passed &= csidh_validate(&keys[0]);
+    passed &= !csidh_validate(invalid);
+    passed &= !csidh_validate(invalid);
+    csidh_validate_cache_stats(&st);
+    passed &= st.hits == 1 && st.misses == 3 && st.evictions == 0;
+
+    for(i = 1; i <= BATCH_COUNT; i++)
+        passed &= csidh_validate(&keys[i]);
+    csidh_validate_cache_stats(&st);
+    passed &= st.hits == 1 && st.misses == 3 + BATCH_COUNT && st.evictions == BATCH_COUNT - 3;
+
+    csidh_validate_cache_free();
+    csidh_validate_cache_stats(&st);
+    passed &= st.hits == 0 && st.misses == 0;
+
+    if (passed == true)
+        printf("\n   Validation cache.....................................PASSED");
+    else
+        printf("\n   Validation cache.....................................FAILED");
+
+    return passed;
+}
+
+int csidh_fast_keypair_test()
+{ // Key generation from the precomputed base points must reach the same public key
+    int i;
+    public_key_t base, pub;
+    private_key_t priv;
+    shared_secret_t out;
+    bool passed = true;
+
+    fp_init_zero(base->A);
+    for(i = 0; i < TEST_COUNT; i++)
+    {
+        csidh_keypair_fast(priv, pub);
+        csidh_sharedsecret(base, priv, out);
+        if(memcmp(out->A, pub->A, NWORDS_64 * 8) != 0)
+            passed = false;
+    }
+
+    if (passed == true)
+        printf("\n   Fixed-base key generation............................PASSED");
+    else
+        printf("\n   Fixed-base key generation............................FAILED");
+
+    return passed;
+}
+
+static bool wire_batch_test(const public_key *pub, const shared_secret *ss)
+{ // Batch conversions must match the single-key ones; the last key of the batch is set to p
+    public_key dec[BATCH_COUNT];
+    shared_secret ssd[BATCH_COUNT];
+    uint8_t buf[BATCH_COUNT * CSIDH_PUBLIC_KEY_BYTES], one[CSIDH_PUBLIC_KEY_BYTES];
+    bool ok[BATCH_COUNT];
+    bool passed = true;
+    int i, j;
+
+    csidh_pub_encode_batch(pub, buf, BATCH_COUNT);
+    passed &= csidh_pub_decode_batch(buf, dec, ok, BATCH_COUNT);
+    for(i = 0; i < BATCH_COUNT; i++)
+    {
+        csidh_pub_encode(&pub[i], one);
+        passed &= memcmp(buf + i * CSIDH_PUBLIC_KEY_BYTES, one, CSIDH_PUBLIC_KEY_BYTES) == 0;
+        passed &= memcmp(pub[i].A, dec[i].A, NWORDS_64 * 8) == 0;
+    }
+
+    csidh_ss_encode_batch(ss, buf, BATCH_COUNT);
+    passed &= csidh_ss_decode_batch(buf, ssd, ok, BATCH_COUNT);
+    for(i = 0; i < BATCH_COUNT; i++)
+    {
+        csidh_ss_encode(&ss[i], one);
+        passed &= memcmp(buf + i * CSIDH_SHARED_SECRET_BYTES, one, CSIDH_SHARED_SECRET_BYTES) == 0;
+        passed &= memcmp(ss[i].A, ssd[i].A, NWORDS_64 * 8) == 0;
+    }
+
+    for(i = 0; i < NWORDS_64; i++)
+        for(j = 0; j < 8; j++)
+            buf[(BATCH_COUNT - 1) * CSIDH_PUBLIC_KEY_BYTES + 8 * i + j] = (uint8_t)(prime511[i] >> (8 * j));
+    passed &= !csidh_pub_decode_batch(buf, dec, ok, BATCH_COUNT);
+    for(i = 0; i < BATCH_COUNT; i++)
+        passed &= ok[i] == (i != BATCH_COUNT - 1);
+    passed &= !csidh_ss_decode_batch(buf, ssd, ok, BATCH_COUNT);
+    for(i = 0; i < BATCH_COUNT; i++)
+        passed &= ok[i] == (i != BATCH_COUNT - 1);
+
+    return passed;
+}
+
+int csidh_wire_format_test()
+{ // Encodings must round-trip and the decoders must reject non-canonical input
+    int i, j;
+    public_key pub[BATCH_COUNT], dec[BATCH_COUNT];
+    private_key_t priv, priv2;
+    shared_secret_t ss, ss2;
+    shared_secret ssb[BATCH_COUNT];
+    uint8_t buf[BATCH_COUNT * CSIDH_PUBLIC_KEY_BYTES];
+    uint8_t key[CSIDH_PRIVATE_KEY_BYTES];
+    bool ok[BATCH_COUNT];
+    bool passed = true;
+#if defined(_X64_)
+    bool adx;
+#endif
+
+    for(i = 0; i < BATCH_COUNT; i++)
+    {
+        csidh_keypair(priv, &pub[i]);
+        csidh_sharedsecret(&pub[0], priv, &ssb[i]);
+    }
+    csidh_sharedsecret(&pub[0], priv, ss);
+
+    passed &= wire_batch_test(pub, ssb);
+#if defined(_X64_)
+    // Without the ADX multiplier the batches go through the 4-lane kernels
+    adx = fp_backend_has_adx();
+    fp_backend_use_adx(false);
+    passed &= wire_batch_test(pub, ssb);
+    fp_backend_use_adx(adx);
+#endif
+
+    csidh_priv_encode(priv, key);
+    passed &= csidh_priv_decode(key, priv2);
+    passed &= memcmp(priv->exponents, priv2->exponents, CSIDH_PRIVATE_KEY_BYTES) == 0;
+    csidh_ss_encode(ss, buf);
+    passed &= csidh_ss_decode(buf, ss2);
+    passed &= memcmp(ss->A, ss2->A, NWORDS_64 * 8) == 0;
+
+    // A = 0 encodes to zeros; p - 1 is the largest canonical value
+    fp_init_zero(pub[0].A);
+    csidh_pub_encode(&pub[0], buf);
+    for(i = 0; i < CSIDH_PUBLIC_KEY_BYTES; i++)
+        passed &= buf[i] == 0;
+    for(i = 0; i < NWORDS_64; i++)
+        for(j = 0; j < 8; j++)
+            buf[8 * i + j] = (uint8_t)(prime511[i] >> (8 * j));
+    passed &= !csidh_pub_decode(buf, &dec[0]);
+    buf[0]--;
+    passed &= csidh_pub_decode(buf, &dec[0]);
+    memset(buf, 0xff, CSIDH_PUBLIC_KEY_BYTES);
+    passed &= !csidh_ss_decode(buf, ss2);
+    passed &= !csidh_pub_decode_batch(buf, dec, ok, 1);
+
+    key[CSIDH_PRIVATE_KEY_BYTES - 1] = MAX_EXPONENT + 1;
+    passed &= !csidh_priv_decode(key, priv2);
+    key[CSIDH_PRIVATE_KEY_BYTES - 1] = ((-MAX_EXPONENT - 1) & 0xf) << 4;
+    passed &= !csidh_priv_decode(key, priv2);
+    key[CSIDH_PRIVATE_KEY_BYTES - 1] = (-MAX_EXPONENT & 0xf) << 4 | MAX_EXPONENT;
+    passed &= csidh_priv_decode(key, priv2);
+
+    if (passed == true)
+        printf("\n   Wire format..........................................PASSED");
+    else
+        printf("\n   Wire format..........................................FAILED");
+
+    return passed;
+}
+
+#ifdef _DUALPOINT_
+static void *action_threads_main(void *arg)
+{ // A thread with its own helper, stopped when the thread exits
+    public_key *pub = arg;
+    private_key_t priv;
+
+    csidh_keypair(priv, pub);
+    return NULL;
+}
+
+int csidh_action_threads_test()
+{ // The twist ladders on a helper thread must not change any result
+    public_key_t base, pub;
+    private_key_t priv;
+    shared_secret_t out;
+    pthread_t tid;
+    bool passed = true;
+
+    fp_init_zero(base->A);
+    csidh_set_action_threads(2);
+    csidh_keypair(priv, pub);
+    csidh_set_action_threads(1);
+    csidh_sharedsecret(base, priv, out);
+    passed &= memcmp(out->A, pub->A, NWORDS_64 * 8) == 0;
+
+    csidh_keypair(priv, pub);
+    csidh_set_action_threads(2);
+    csidh_sharedsecret(base, priv, out);
+    passed &= memcmp(out->A, pub->A, NWORDS_64 * 8) == 0;
+
+    // The parked helper of this thread takes a second action; another thread gets its own
+    csidh_sharedsecret(base, priv, out);
+    passed &= memcmp(out->A, pub->A, NWORDS_64 * 8) == 0;
+    passed &= pthread_create(&tid, NULL, action_threads_main, pub) == 0 && pthread_join(tid, NULL) == 0;
+    passed &= csidh_validate(pub);
+    csidh_set_action_threads(1);
+
+    if (passed == true)
+        printf("\n   Two-thread action....................................PASSED");
+    else
+        printf("\n   Two-thread action....................................FAILED");
+
+    return passed;
+}
+#endif
+
+#ifdef _CONSTANT_
+int csidh_simba_test()
+{ // Every batch count must reach the public key of the default schedule
+    int m;
+    public_key_t base, pub;
+    private_key_t priv;
+    shared_secret_t out;
+    bool passed = true;
+
+    fp_init_zero(base->A);
+    csidh_keypair(priv, pub);
+    for(m = 1; m <= 2; m++)
+    {
+        csidh_set_simba_batches(m);
+        csidh_sharedsecret(base, priv, out);
+        if(memcmp(out->A, pub->A, NWORDS_64 * 8) != 0)
+            passed = false;
+    }
+    csidh_set_simba_batches(SIMBA_BATCHES);
+
+    if (passed == true)
+        printf("\n   SIMBA batches........................................PASSED");
+    else
+        printf("\n   SIMBA batches........................................FAILED");
+
+    return passed;
+}
+
+void simba_bench()
+{ // Key generation against the number of SIMBA batches; m = 1 is the original 51-round loop
+    int m;
+    public_key_t pub;
+    private_key_t priv;
+    unsigned long long start, end;
+
+    for(m = 1; m <= 8; m++)
+    {
+        csidh_set_simba_batches(m);
+        start = cpucycles();
+        csidh_keypair(priv, pub);
+        end = cpucycles();
+#ifdef _FASTLADDER_
+        printf("Key generation with %d SIMBA batch(es), fast ladder........%10lld nsec\n", m, end - start);
+#else
+        printf("Key generation with %d SIMBA batch(es).....................%10lld nsec\n", m, end - start);
+#endif
+    }
+    printf("\n");
+    csidh_set_simba_batches(SIMBA_BATCHES);
+}
+#endif
+
+void validate_scaling_bench()
+{ // Latency of a single validation against the number of threads
+    int i, t;
+    public_key_t pub;
+    private_key_t priv;
+    unsigned long long cycles, start, end;
+
+    csidh_keypair(priv, pub);
+    for(t = 1; t <= 8; t *= 2)
+    {
+        csidh_set_validate_threads(t);
+        cycles = 0;
+        for(i = 0; i < BENCH_COUNT; i++)
+        {
+            start = cpucycles();
+            csidh_validate(pub);
+            end = cpucycles();
+            cycles = cycles + (end - start);
+        }
+        printf("Public-key validation with %d thread(s)...................%10lld nsec\n", t, cycles/BENCH_COUNT);
+    }
+    csidh_set_validate_threads(1);
+    printf("\n");
+}
+
+void keypair_scaling_bench()
+{ // Throughput of csidh_keypair_batch from 1 to all online cores
+    int t, cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    size_t n;
+    unsigned long long start, end;
+    public_key *pub;
+    private_key *priv;
+
+    if (cores < 1)
+        cores = 1;
+    pub = malloc(cores * BATCH_COUNT * sizeof(public_key));
+    priv = malloc(cores * BATCH_COUNT * sizeof(private_key));
+    if (pub == NULL || priv == NULL)
+    {
+        free(pub);
+        free(priv);
+        return;
+    }
+
+    for(t = 1; t <= cores; t++)
+    {
+        n = (size_t)t * BATCH_COUNT;
+        start = cpucycles();
+        csidh_keypair_batch(priv, pub, n, t);
+        end = cpucycles();
+        printf("Batch key generation with %3d thread(s)..................%10.2f keys/sec\n", t, n * 1e9 / (double)(end - start));
+    }
+    printf("\n");
+
+    free(pub);
+    free(priv);
+}
+
 void csidh_bench()
 {
     int i;
@@ -132,6 +600,30 @@ void csidh_bench()
     printf("Bob Key generation runs in................................%10lld nsec\n", cycles/BENCH_COUNT);
     bob_total = cycles/BENCH_COUNT;
 
+    cycles = 0;
+    for(i = 0; i < BENCH_COUNT; i++)
+    {
+        start = cpucycles();
+        csidh_keypair_fast(alice_priv, alice_pub);
+        end = cpucycles();
+        cycles = cycles + (end - start);
+    }
+    printf("Fixed-base Key generation runs in.........................%10lld nsec\n", cycles/BENCH_COUNT);
+
+#ifdef _DUALPOINT_
+    csidh_set_action_threads(2);
+    cycles = 0;
+    for(i = 0; i < BENCH_COUNT; i++)
+    {
+        start = cpucycles();
+        csidh_keypair(alice_priv, alice_pub);
+        end = cpucycles();
+        cycles = cycles + (end - start);
+    }
+    csidh_set_action_threads(1);
+    printf("Key generation with 2 action threads runs in..............%10lld nsec\n", cycles/BENCH_COUNT);
+#endif
+
     // Benchmarking Public-key validation
     cycles = 0;
     for(i = 0; i < BENCH_COUNT; i++)
@@ -155,6 +647,20 @@ void csidh_bench()
     printf("Bob validation of Alice's Public-Key runs in..............%10lld nsec\n", cycles/BENCH_COUNT);
     bob_total += cycles/BENCH_COUNT;
 
+    // A peer key seen before, with the validation cache enabled
+    csidh_validate_cache_init(1024);
+    csidh_validate(alice_pub);
+    cycles = 0;
+    for(i = 0; i < BENCH_COUNT; i++)
+    {
+        start = cpucycles();
+        csidh_validate(alice_pub);
+        end = cpucycles();
+        cycles = cycles + (end - start);
+    }
+    csidh_validate_cache_free();
+    printf("Cached validation of a Public-Key runs in.................%10lld nsec\n", cycles/BENCH_COUNT);
+
     // Benchmarking shared-secret computations
     cycles = 0;
     for(i = 0; i < BENCH_COUNT; i++)
@@ -180,19 +686,161 @@ void csidh_bench()
 
     printf("\nAlice Total computations runs in.........................%10lld nsec\n", alice_total);
     printf("Bob Total computations runs in...........................%10lld nsec\n\n", bob_total);
+
+    // Benchmarking the batch API, reported per key
+    public_key pub_batch[BATCH_COUNT];
+    private_key priv_batch[BATCH_COUNT];
+    shared_secret shared_batch[BATCH_COUNT];
+
+    cycles = 0;
+    for(i = 0; i < BENCH_COUNT; i++)
+    {
+        start = cpucycles();
+        csidh_keypair_batch(priv_batch, pub_batch, BATCH_COUNT, 1);
+        end = cpucycles();
+        cycles = cycles + (end - start);
+    }
+    printf("Batch key generation runs in (per key, n = %d)............%10lld nsec\n", BATCH_COUNT, cycles/(BENCH_COUNT * BATCH_COUNT));
+
+    cycles = 0;
+    for(i = 0; i < BENCH_COUNT; i++)
+    {
+        start = cpucycles();
+        csidh_sharedsecret_batch(pub_batch, priv_batch, shared_batch, BATCH_COUNT);
+        end = cpucycles();
+        cycles = cycles + (end - start);
+    }
+    printf("Batch shared key generation runs in (per key, n = %d).....%10lld nsec\n", BATCH_COUNT, cycles/(BENCH_COUNT * BATCH_COUNT));
+
+    cycles = 0;
+    for(i = 0; i < BENCH_COUNT; i++)
+    {
+        start = cpucycles();
+        csidh_sharedsecret_x4(pub_batch, priv_batch, shared_batch);
+        end = cpucycles();
+        cycles = cycles + (end - start);
+    }
+    printf("x4 shared key generation runs in (per key)...............%10lld nsec\n\n", cycles/(BENCH_COUNT * 4));
+
+    keypair_scaling_bench();
+    validate_scaling_bench();
+#ifdef _CONSTANT_
+    simba_bench();
+#endif
     return;
 }
 
-int main()
+static chacha20_drbg_t seeded_drbg;
+static pthread_mutex_t seeded_drbg_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void seeded_randombytes(void *ctx, void *x, size_t l)
+{ // The seeded DRBG is shared by the threads of the scaling benchmark
+    pthread_mutex_lock(&seeded_drbg_lock);
+    chacha20_drbg_randombytes(ctx, x, l);
+    pthread_mutex_unlock(&seeded_drbg_lock);
+}
+
+#ifdef _TRACE_ROUNDS_
+int csidh_trace_test()
+{ // Every action leaves consecutive rounds whose real isogenies add up to its exponents
+    static csidh_trace_round r[CSIDH_TRACE_CAPACITY];
+    public_key_t pub;
+    private_key_t priv[TRACE_COUNT];
+    size_t n, k = 0;
+    int i, j, sum;
+    int8_t t;
+    bool passed = true;
+    FILE *f;
+
+    csidh_trace_reset();
+    for (i = 0; i < TRACE_COUNT; i++)
+        csidh_keypair(priv[i], pub);
+    n = csidh_trace_dump(r, CSIDH_TRACE_CAPACITY);
+
+    for (i = 0; i < TRACE_COUNT; i++)
+    {
+        sum = 0;
+        for (j = 0; j < SMALL_PRIMES_COUNT; j++)
+        {
+            t = (int8_t)(priv[i]->exponents[j / 2] << j % 2 * 4) >> 4;
+            sum += t < 0 ? -t : t;
+        }
+        for (j = 0; k < n && r[k].action == (uint32_t)i; j++, k++)
+        {
+            passed &= r[k].round == j;
+            sum -= r[k].real;
+        }
+        passed &= j > 0 && sum == 0 && r[k - 1].done == 3 && r[k - 1].remaining == 0;
+    }
+    passed &= k == n;
+
+    if ((f = fopen("csidh_trace.csv", "w")) != NULL)
+    {
+        csidh_trace_write(f);
+        fclose(f);
+    }
+
+    if (passed == true)
+        printf("\n   Round trace (csidh_trace.csv)........................PASSED");
+    else
+        printf("\n   Round trace (csidh_trace.csv)........................FAILED");
+
+    return passed;
+}
+#endif
+
+int main(int argc, char *argv[])
 {
-    int passed = 1;
+    int i, passed = 1;
+    uint8_t seed[32] = {0};
+    uint64_t s;
+
+    // CSIDH_TEST <seed> draws every key and point from a seeded DRBG so that
+    // benchmark runs are reproducible
+    if (argc > 1)
+    {
+        s = strtoull(argv[1], NULL, 0);
+        for (i = 0; i < 8; i++)
+            seed[i] = (uint8_t)(s >> (8 * i));
+        chacha20_drbg_init(&seeded_drbg, seed);
+        rng_set_callback(seeded_randombytes, &seeded_drbg);
+        printf("\nDeterministic RNG, seed %s\n", argv[1]);
+    }
     passed = csidh_test();
+    passed &= csidh_batch_test();
+    passed &= csidh_x4_test();
+    passed &= csidh_invalid_key_test();
+    passed &= csidh_parallel_validate_test();
+    passed &= csidh_validate_cache_test();
+    passed &= csidh_fast_keypair_test();
+    passed &= csidh_wire_format_test();
+#ifdef _CONSTANT_
+    passed &= csidh_simba_test();
+#endif
+#ifdef _DUALPOINT_
+    passed &= csidh_action_threads_test();
+#endif
+#ifdef _TRACE_ROUNDS_
+    passed &= csidh_trace_test();
+#endif
 
     if (!passed)
     {
         printf("\n\n Error: SHARED_KEY");
     }
 
+#ifdef _PROFILE_OPS_
+    {
+        public_key_t pub;
+        private_key_t priv;
+
+        profile_ops_reset();
+        csidh_keypair(priv, pub);
+        csidh_validate(pub);
+        profile_ops_print("\n\nKey generation and validation");
+    }
+#endif
+
     csidh_bench();
     return passed;
 }
\ No newline at end of file
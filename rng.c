@@ -1,18 +1,184 @@
-
 #include "rng.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/random.h>
 
-void randombytes(void *x, size_t l)
+#define ROTL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+#define QUARTERROUND(a, b, c, d)                    \
+    a += b; d ^= a; d = ROTL32(d, 16);              \
+    c += d; b ^= c; b = ROTL32(b, 12);              \
+    a += b; d ^= a; d = ROTL32(d, 8);               \
+    c += d; b ^= c; b = ROTL32(b, 7);
+
+static rng_callback_t rng_callback = NULL;
+static void *rng_ctx = NULL;
+
+static __thread chacha20_drbg_t thread_drbg;
+static __thread int thread_drbg_seeded = 0;
+
+static pthread_once_t rng_once = PTHREAD_ONCE_INIT;
+static pthread_key_t rng_key;
+
+void chacha20_block(const uint32_t key[8], uint64_t counter, uint64_t nonce, uint8_t out[64])
 {
-    static int fd = -1;
+    uint32_t in[16], x[16];
+    int i;
+
+    in[0] = 0x61707865; in[1] = 0x3320646e; in[2] = 0x79622d32; in[3] = 0x6b206574;
+    for (i = 0; i < 8; i++)
+        in[4 + i] = key[i];
+    in[12] = (uint32_t)counter; in[13] = (uint32_t)(counter >> 32);
+    in[14] = (uint32_t)nonce;   in[15] = (uint32_t)(nonce >> 32);
+
+    memcpy(x, in, sizeof(x));
+    for (i = 0; i < 10; i++)
+    {
+        QUARTERROUND(x[0], x[4], x[8],  x[12])
+        QUARTERROUND(x[1], x[5], x[9],  x[13])
+        QUARTERROUND(x[2], x[6], x[10], x[14])
+        QUARTERROUND(x[3], x[7], x[11], x[15])
+        QUARTERROUND(x[0], x[5], x[10], x[15])
+        QUARTERROUND(x[1], x[6], x[11], x[12])
+        QUARTERROUND(x[2], x[7], x[8],  x[13])
+        QUARTERROUND(x[3], x[4], x[9],  x[14])
+    }
+
+    for (i = 0; i < 16; i++)
+    {
+        x[i] += in[i];
+        out[4 * i + 0] = (uint8_t)(x[i]);
+        out[4 * i + 1] = (uint8_t)(x[i] >> 8);
+        out[4 * i + 2] = (uint8_t)(x[i] >> 16);
+        out[4 * i + 3] = (uint8_t)(x[i] >> 24);
+    }
+}
+
+static void chacha20_drbg_refill(chacha20_drbg_t *d)
+{
+    int i;
+
+    // A fresh key per refill, so the counter always starts from zero
+    for (i = 0; i < RNG_BUFFER_BYTES / 64; i++)
+        chacha20_block(d->key, (uint64_t)i, d->nonce, d->buf + 64 * i);
+
+    for (i = 0; i < 8; i++)
+        d->key[i] = (uint32_t)d->buf[4 * i] | (uint32_t)d->buf[4 * i + 1] << 8 |
+                    (uint32_t)d->buf[4 * i + 2] << 16 | (uint32_t)d->buf[4 * i + 3] << 24;
+    memset(d->buf, 0, 32);
+    d->pos = 32;
+}
+
+void chacha20_drbg_init(chacha20_drbg_t *d, const uint8_t seed[32])
+{
+    int i;
+
+    for (i = 0; i < 8; i++)
+        d->key[i] = (uint32_t)seed[4 * i] | (uint32_t)seed[4 * i + 1] << 8 |
+                    (uint32_t)seed[4 * i + 2] << 16 | (uint32_t)seed[4 * i + 3] << 24;
+    d->nonce = 0;
+    d->pos = RNG_BUFFER_BYTES;
+}
+
+void chacha20_drbg_randombytes(void *ctx, void *x, size_t l)
+{
+    chacha20_drbg_t *d = ctx;
+    uint8_t *out = x;
+    size_t n;
+
+    while (l > 0)
+    {
+        if (d->pos == RNG_BUFFER_BYTES)
+            chacha20_drbg_refill(d);
+        n = RNG_BUFFER_BYTES - d->pos;
+        if (n > l)
+            n = l;
+        memcpy(out, d->buf + d->pos, n);
+        memset(d->buf + d->pos, 0, n);
+        d->pos += n;
+        out += n;
+        l -= n;
+    }
+}
+
+static void os_seed(uint8_t *seed, size_t l)
+{
+    // getrandom() blocks only until the kernel pool is initialized;
+    // /dev/urandom covers kernels without the system call
+    size_t i = 0;
     ssize_t n;
-    if (fd < 0 && 0 > (fd = open("/dev/urandom", O_RDONLY)))
+    int fd;
+
+    while (i < l)
+    {
+        n = getrandom(seed + i, l - i, 0);
+        if (n > 0)
+            i += n;
+        else if (n < 0 && errno == EINTR)
+            continue;
+        else
+            break;
+    }
+    if (i == l)
+        return;
+
+    if (0 > (fd = open("/dev/urandom", O_RDONLY)))
         exit(1);
-    for (size_t i = 0; i < l; i += n)
-        if (0 >= (n = read(fd, (char *) x + i, l - i)))
+    for (; i < l; i += n)
+        if (0 >= (n = read(fd, seed + i, l - i)))
             exit(2);
+    close(fd);
+}
+
+// The child of fork() must not replay the stream of its parent: its only
+// thread drops the inherited key and buffer and reseeds on next use
+static void rng_atfork_child(void)
+{
+    memset(&thread_drbg, 0, sizeof(thread_drbg));
+    thread_drbg_seeded = 0;
+}
+
+// Wipes the next key and the buffered bytes of an exiting thread
+static void rng_thread_exit(void *d)
+{
+    memset(d, 0, sizeof(chacha20_drbg_t));
 }
 
+static void rng_init(void)
+{
+    pthread_key_create(&rng_key, rng_thread_exit);
+    pthread_atfork(NULL, NULL, rng_atfork_child);
+}
+
+void rng_set_callback(rng_callback_t fn, void *ctx)
+{
+    rng_callback = fn;
+    rng_ctx = ctx;
+}
+
+void randombytes(void *x, size_t l)
+{
+    uint8_t seed[32];
+
+    if (rng_callback != NULL)
+    {
+        rng_callback(rng_ctx, x, l);
+        return;
+    }
+
+    if (!thread_drbg_seeded)
+    {
+        pthread_once(&rng_once, rng_init);
+        pthread_setspecific(rng_key, &thread_drbg);
+        os_seed(seed, sizeof(seed));
+        chacha20_drbg_init(&thread_drbg, seed);
+        memset(seed, 0, sizeof(seed));
+        thread_drbg_seeded = 1;
+    }
+    chacha20_drbg_randombytes(&thread_drbg, x, l);
+}
@@ -1,8 +1,48 @@
 #ifndef RNG_H
 #define RNG_H
 
+#include <stdint.h>
 #include <stdlib.h>
 
+// Bytes produced per DRBG refill (16 ChaCha20 blocks)
+#define RNG_BUFFER_BYTES    1024
+
+// ChaCha20 DRBG with fast key erasure: every refill generates RNG_BUFFER_BYTES
+// of keystream, takes the first 32 bytes as the next key and serves the rest.
+// Served bytes are wiped from the buffer.
+typedef struct chacha20_drbg {
+    uint32_t key[8];
+    uint64_t nonce;
+    size_t pos;
+    uint8_t buf[RNG_BUFFER_BYTES];
+} chacha20_drbg_t;
+
+// Source of random bytes: fills x with l bytes
+typedef void (*rng_callback_t)(void *ctx, void *x, size_t l);
+
+/*
+randombytes serves every random byte of the library (private keys and the points sampled by
+fp_random_512). By default each thread owns a ChaCha20 DRBG seeded from getrandom() on first
+use, so no lock and no system call is needed on the hot path. A pthread_atfork handler makes
+the child of fork() reseed instead of repeating the bytes of its parent, and the state of a
+thread is wiped when it exits. Processes created with a raw clone() or vfork() are not covered.
+*/
 void randombytes(void *x, size_t l);
 
+/*
+Replaces the default source, e.g. with a chacha20_drbg_t seeded from a fixed value so that
+benchmarks are reproducible. Passing NULL restores the per-thread DRBG. The callback is
+shared by all threads: set it before starting any, and make it thread-safe if several
+threads draw from it.
+*/
+void rng_set_callback(rng_callback_t fn, void *ctx);
+
+void chacha20_drbg_init(chacha20_drbg_t *d, const uint8_t seed[32]);
+
+// rng_callback_t over a chacha20_drbg_t passed as ctx
+void chacha20_drbg_randombytes(void *ctx, void *x, size_t l);
+
+// ChaCha20 block: state words 12-13 hold the counter, 14-15 the nonce
+void chacha20_block(const uint32_t key[8], uint64_t counter, uint64_t nonce, uint8_t out[64]);
+
 #endif
@@ -0,0 +1,161 @@
+/****************************************************************************
+*   Efficient implementation of finite field arithmetic over p511 on ARMv8
+*                   Constant-time Implementation of CSIDH
+*
+*   Summary of a round trace written by csidh_trace_write (TRACE_ROUNDS=TRUE)
+*
+*   TRACE_SUMMARY [FILE]        reads standard input without FILE
+*****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_ROUNDS      1024
+#define MAX_BATCHES     256
+
+typedef struct batch_stats {
+    unsigned long rounds, real, failed, idle;
+} batch_stats;
+
+static unsigned long hist[MAX_ROUNDS + 1];     // actions by number of rounds
+static batch_stats batches[MAX_BATCHES];
+
+typedef struct action_stats {
+    unsigned long actions, unfinished, incomplete;
+    unsigned long rounds, min_rounds, max_rounds;
+    unsigned long tail, max_tail;               // rounds run after both signs were done
+} action_stats;
+
+// Accounts an action of n rounds whose signs were both done after round `finished`, or never (-1)
+static void close_action(action_stats *a, unsigned long n, long finished)
+{
+    unsigned long tail;
+
+    if (n == 0)
+        return;
+    a->actions++;
+    a->rounds += n;
+    if (n < a->min_rounds)
+        a->min_rounds = n;
+    if (n > a->max_rounds)
+        a->max_rounds = n;
+    hist[n < MAX_ROUNDS ? n : MAX_ROUNDS]++;
+
+    if (finished < 0)
+    {
+        a->unfinished++;
+        return;
+    }
+    tail = n - 1 - (unsigned long)finished;
+    a->tail += tail;
+    if (tail > a->max_tail)
+        a->max_tail = tail;
+}
+
+int main(int argc, char *argv[])
+{
+    FILE *f = stdin;
+    char line[256];
+    unsigned int action, round, batch, sign, real, dummy, failed, done, remaining;
+    unsigned long records = 0, signs[3] = {0}, total_real = 0, total_dummy = 0, total_failed = 0, n = 0;
+    unsigned long last_action = ~0UL, i, peak = 0;
+    long finished = -1;
+    action_stats a;
+    int j, bar, skip = 0;
+
+    if (argc > 2 || (argc == 2 && (f = fopen(argv[1], "r")) == NULL))
+    {
+        if (argc == 2)
+            perror(argv[1]);
+        else
+            printf("usage: %s [FILE]\n", argv[0]);
+        return 1;
+    }
+
+    memset(&a, 0, sizeof(a));
+    a.min_rounds = ~0UL;
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        if (sscanf(line, "%u,%u,%u,%u,%u,%u,%u,%u,%u", &action, &round, &batch, &sign, &real,
+                   &dummy, &failed, &done, &remaining) != 9)
+            continue;       // header
+
+        if (action != last_action)
+        {
+            close_action(&a, n, finished);
+            last_action = action;
+            n = 0;
+            finished = -1;
+            // The ring buffer may have dropped the first rounds of the oldest action
+            skip = round != 0;
+            a.incomplete += skip;
+        }
+        if (skip || round != n)
+            continue;
+
+        records++;
+        signs[sign < 2 ? sign : 2]++;
+        total_real += real;
+        total_dummy += dummy;
+        total_failed += failed;
+        if (batch < MAX_BATCHES)
+        {
+            batches[batch].rounds++;
+            batches[batch].real += real;
+            batches[batch].failed += failed;
+            batches[batch].idle += (real == 0);
+        }
+        if (done == 3 && finished < 0)
+            finished = (long)round;
+        n++;
+    }
+    close_action(&a, n, finished);
+    if (f != stdin)
+        fclose(f);
+
+    if (a.actions == 0)
+    {
+        printf("No complete action in the trace\n");
+        return 1;
+    }
+
+    printf("Actions: %lu complete", a.actions);
+    if (a.incomplete)
+        printf(", %lu truncated by the ring buffer", a.incomplete);
+    printf(", %lu rounds\n", records);
+    printf("Rounds per action: min %lu, mean %.2f, max %lu\n", a.min_rounds,
+           (double)a.rounds / (double)a.actions, a.max_rounds);
+    printf("Rounds after both signs were done: mean %.2f, max %lu\n",
+           a.actions > a.unfinished ? (double)a.tail / (double)(a.actions - a.unfinished) : 0.0, a.max_tail);
+    printf("Actions with exponents left at the end: %lu\n", a.unfinished);
+    printf("Signs of the rounds: %lu positive, %lu negative, %lu both\n", signs[0], signs[1], signs[2]);
+    printf("Isogenies per round: %.2f real, %.2f dummy, %.2f failed kernels\n",
+           (double)total_real / (double)records, (double)total_dummy / (double)records,
+           (double)total_failed / (double)records);
+    printf("Failed kernels: %.2f%% of the isogenies in use\n",
+           total_real + total_failed ? 100.0 * (double)total_failed / (double)(total_real + total_failed) : 0.0);
+
+    for (i = 1; i < MAX_BATCHES && batches[i].rounds; i++);
+    if (i > 1)
+    {
+        printf("\nBatch   rounds   real/round   failed/round   idle rounds\n");
+        for (i = 0; i < MAX_BATCHES && batches[i].rounds; i++)
+            printf("%5lu %8lu %12.2f %14.2f %12.1f%%\n", i, batches[i].rounds,
+                   (double)batches[i].real / (double)batches[i].rounds,
+                   (double)batches[i].failed / (double)batches[i].rounds,
+                   100.0 * (double)batches[i].idle / (double)batches[i].rounds);
+    }
+
+    printf("\nRounds  actions\n");
+    for (i = 0; i <= MAX_ROUNDS; i++)
+        if (hist[i] > peak)
+            peak = hist[i];
+    for (i = a.min_rounds; i <= a.max_rounds && i <= MAX_ROUNDS; i++)
+    {
+        bar = (int)(40 * hist[i] / peak);
+        printf("%5lu%s |", i, i == MAX_ROUNDS ? "+" : " ");
+        for (j = 0; j < bar; j++)
+            putchar('#');
+        printf(" %lu\n", hist[i]);
+    }
+    return 0;
+}